@@ -17,20 +17,39 @@
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/EPCEHFrameRegistrar.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
-#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/MapperJITLinkMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/MemoryMapper.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace llvm {
 namespace orc {
 
+// JIT'd code is allocated out of slabs of this much reserved address space.
+// This saves an mmap per section and keeps code close together, but each
+// module's segments are still page aligned: a small module still takes a
+// page for its code and another for each kind of data, so RSS per module is
+// the same as with a memory manager per object. Packing several modules into
+// shared pages would take a sub-page allocator, which this doesn't have.
+const size_t JITSlabSize = 64 * 1024 * 1024;
+
 class KaleidoscopeJIT {
 private:
   std::unique_ptr<ExecutionSession> ES;
@@ -38,27 +57,55 @@ private:
   DataLayout DL;
   MangleAndInterner Mangle;
 
-  RTDyldObjectLinkingLayer ObjectLayer;
+  ObjectLinkingLayer ObjectLayer;
   IRCompileLayer CompileLayer;
 
   JITDylib &MainJD;
 
+  // every def'd function is called through a stub, so redefining it only
+  // has to repoint the stub and the old body can be freed
+  std::unique_ptr<IndirectStubsManager> ISM;
+  std::map<std::string, ResourceTrackerSP> DefinitionRTs;
+  unsigned DefinitionCount = 0;
+
+  // replaced bodies that a host thread may still be running, and how many
+  // host calls into JIT'd code are running right now (see enterCall).
+  // RetiredMutex guards Retired, the last call out may free it on its own thread
+  std::mutex RetiredMutex;
+  std::vector<ResourceTrackerSP> Retired;
+  std::atomic<bool> AnyRetired{false};
+  std::atomic<unsigned> CallsInFlight{0};
+
+  // same CPU and features the code is compiled for, for IR-level passes
+  std::unique_ptr<TargetMachine> TM;
+
 public:
   KaleidoscopeJIT(std::unique_ptr<ExecutionSession> ES,
-                  JITTargetMachineBuilder JTMB, DataLayout DL)
+                  JITTargetMachineBuilder JTMB, DataLayout DL,
+                  std::unique_ptr<jitlink::JITLinkMemoryManager> MemMgr,
+                  std::unique_ptr<jitlink::EHFrameRegistrar> EHFrames,
+                  std::unique_ptr<IndirectStubsManager> ISM,
+                  std::unique_ptr<TargetMachine> TM)
       : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
-        ObjectLayer(*this->ES,
-                    []() { return std::make_unique<SectionMemoryManager>(); }),
+        ObjectLayer(*this->ES, std::move(MemMgr)),
         CompileLayer(*this->ES, ObjectLayer,
                      std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
-        MainJD(this->ES->createBareJITDylib("<main>")) {
-    MainJD.addGenerator(
-        cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
-            DL.getGlobalPrefix())));
-    if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
+        MainJD(this->ES->createBareJITDylib("<main>")), ISM(std::move(ISM)),
+        TM(std::move(TM)) {
+    // unwinding (C++ exceptions, debuggers, profilers) has to get through
+    // JIT'd frames, so their .eh_frame sections are registered
+    ObjectLayer.addPlugin(std::make_unique<EHFrameRegistrationPlugin>(
+        *this->ES, std::move(EHFrames)));
+    // COFF objects don't mark their symbols the way ORC expects
+    if (this->ES->getExecutorProcessControl()
+            .getTargetTriple()
+            .isOSBinFormatCOFF()) {
       ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
       ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
     }
+    MainJD.addGenerator(
+        cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            DL.getGlobalPrefix())));
   }
 
   ~KaleidoscopeJIT() {
@@ -66,7 +113,11 @@ public:
       ES->reportError(std::move(Err));
   }
 
-  static Expected<std::unique_ptr<KaleidoscopeJIT>> Create() {
+  // Compile for CPU, or for the host's CPU and all of its features (AVX2,
+  // AVX-512, ...) if CPU is empty. Pinning a baseline CPU gives code that
+  // runs on every machine of a mixed fleet.
+  static Expected<std::unique_ptr<KaleidoscopeJIT>>
+  Create(StringRef CPU = "") {
     auto EPC = SelfExecutorProcessControl::Create();
     if (!EPC)
       return EPC.takeError();
@@ -75,27 +126,217 @@ public:
 
     JITTargetMachineBuilder JTMB(
         ES->getExecutorProcessControl().getTargetTriple());
+    if (CPU.empty()) {
+      auto Host = JITTargetMachineBuilder::detectHost();
+      if (!Host)
+        return Host.takeError();
+      JTMB = std::move(*Host);
+    } else {
+      JTMB.setCPU(CPU.str());
+    }
+    // everything in a slab is close together, and JITLink builds stubs for
+    // calls out to the host process, so the small code model is enough
+    JTMB.setCodeModel(CodeModel::Small);
 
     auto DL = JTMB.getDefaultDataLayoutForTarget();
     if (!DL)
       return DL.takeError();
 
-    return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(JTMB),
-                                             std::move(*DL));
+    auto MemMgr =
+        MapperJITLinkMemoryManager::CreateWithMapper<InProcessMemoryMapper>(
+            JITSlabSize);
+    if (!MemMgr)
+      return MemMgr.takeError();
+
+    auto EHFrames = EPCEHFrameRegistrar::Create(*ES);
+    if (!EHFrames)
+      return EHFrames.takeError();
+
+    auto ISM =
+        createLocalIndirectStubsManagerBuilder(JTMB.getTargetTriple())();
+
+    auto TM = JTMB.createTargetMachine();
+    if (!TM)
+      return TM.takeError();
+
+    return std::make_unique<KaleidoscopeJIT>(
+        std::move(ES), std::move(JTMB), std::move(*DL), std::move(*MemMgr),
+        std::move(*EHFrames), std::move(ISM), std::move(*TM));
   }
 
   const DataLayout &getDataLayout() const { return DL; }
 
   JITDylib &getMainJITDylib() { return MainJD; }
 
+  ObjectLinkingLayer &getObjectLayer() { return ObjectLayer; }
+
+  TargetMachine *getTargetMachine() { return TM.get(); }
+  StringRef getTargetCPU() const { return TM->getTargetCPU(); }
+  StringRef getTargetFeatures() const { return TM->getTargetFeatureString(); }
+
   Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
     if (!RT)
       RT = MainJD.getDefaultResourceTracker();
     return CompileLayer.add(RT, std::move(TSM));
   }
 
+  // Make Name resolve to a function of the host program at Addr.
+  Error addHostFunction(StringRef Name, void *Addr) {
+    return MainJD.define(absoluteSymbols(
+        {{Mangle(Name), {ExecutorAddr::fromPtr(Addr),
+                         JITSymbolFlags::Exported | JITSymbolFlags::Callable}}}));
+  }
+
+  // Add a module holding the definition of function Name. The body gets a
+  // fresh symbol and its own ResourceTracker, and Name itself is a stub that
+  // points at the newest body. Redefining Name repoints the stub and frees
+  // the previous body's code and data once no host call is running (see
+  // enterCall). Callers are compiled against Name's signature, so a new body
+  // must take the same parameters and return the same type.
+  // Redefinitions must not run concurrently with each other.
+  Error addDefinition(StringRef FnName, ThreadSafeModule TSM) {
+    std::string Name = FnName.str(); // FnName may point into the module
+    std::string ImplName = Name + "." + std::to_string(DefinitionCount++);
+    TSM.withModuleDo(
+        [&](Module &M) { M.getFunction(Name)->setName(ImplName); });
+
+    auto RT = MainJD.createResourceTracker();
+    if (auto Err = CompileLayer.add(RT, std::move(TSM)))
+      return Err;
+    return bindDefinition(Name, ImplName, std::move(RT));
+  }
+
+  // Like addDefinition, but the body is already compiled: Obj is an object
+  // file defining function Name under the symbol ImplName.
+  Error addDefinitionObject(StringRef Name, StringRef ImplName,
+                            std::unique_ptr<MemoryBuffer> Obj) {
+    auto RT = MainJD.createResourceTracker();
+    if (auto Err = ObjectLayer.add(RT, std::move(Obj)))
+      return Err;
+    return bindDefinition(Name.str(), ImplName.str(), std::move(RT));
+  }
+
+  // A JITDylib for a separately compiled library. Its code resolves symbols
+  // in itself first, then the main JITDylib and the libraries before it, and
+  // the main JITDylib's code can see it. Nothing added to it is compiled or
+  // linked until one of its symbols is looked up.
+  JITDylib &createLibraryJITDylib(StringRef Name) {
+    auto &JD = ES->createBareJITDylib(Name.str());
+    JITDylibSearchOrder Order;
+    MainJD.withLinkOrderDo(
+        [&](const JITDylibSearchOrder &O) { Order = O; });
+    JD.setLinkOrder(std::move(Order));
+    MainJD.addToLinkOrder(JD);
+    return JD;
+  }
+
+  // Undoes createLibraryJITDylib for a library that failed to load: frees
+  // everything added to JD and takes it out of the search order. Only valid
+  // before anything else has been linked against JD.
+  Error removeLibraryJITDylib(JITDylib &JD) {
+    MainJD.removeFromLinkOrder(JD);
+    return ES->removeJITDylib(JD);
+  }
+
+  Error addLibraryModule(JITDylib &JD, ThreadSafeModule TSM) {
+    return CompileLayer.add(JD, std::move(TSM));
+  }
+
+  // Obj defines function Name as ImplName (see addDefinitionObject), Name is
+  // made an alias for it.
+  Error addLibraryObject(JITDylib &JD, StringRef Name, StringRef ImplName,
+                         std::unique_ptr<MemoryBuffer> Obj) {
+    if (auto Err = ObjectLayer.add(JD, std::move(Obj)))
+      return Err;
+    return JD.define(symbolAliases(
+        {{Mangle(Name), {Mangle(ImplName), JITSymbolFlags::Exported |
+                                               JITSymbolFlags::Callable}}}));
+  }
+
+  // Host threads that call into JIT'd code bracket each call with these, so
+  // that a body replaced in the meantime is not freed while they might be
+  // running it. The thread that redefines functions doesn't need to. The last
+  // call to leave frees whatever was replaced while calls were running.
+  void enterCall() { CallsInFlight.fetch_add(1); }
+  void leaveCall() {
+    if (CallsInFlight.fetch_sub(1) == 1 && AnyRetired.load()) {
+      // a redefinition holding the lock frees them itself when it's done
+      std::unique_lock<std::mutex> Lock(RetiredMutex, std::try_to_lock);
+      if (Lock.owns_lock())
+        if (auto Err = freeRetiredLocked())
+          ES->reportError(std::move(Err));
+    }
+  }
+
+  bool hasDefinition(StringRef Name) const {
+    return DefinitionRTs.count(Name.str());
+  }
+
+  // Address of the pointer that function Name's stub jumps through. It always
+  // holds the newest body, so hosts can call through it without a lookup.
+  Expected<ExecutorAddr> getDefinitionPointer(StringRef Name) {
+    if (!DefinitionRTs.count(Name.str()))
+      return make_error<StringError>("no definition of " + Name,
+                                     inconvertibleErrorCode());
+    return ISM->findPointer(Name).getAddress();
+  }
+
+  // Searches the main JITDylib, then the libraries.
   Expected<ExecutorSymbolDef> lookup(StringRef Name) {
-    return ES->lookup({&MainJD}, Mangle(Name.str()));
+    JITDylibSearchOrder Order;
+    MainJD.withLinkOrderDo(
+        [&](const JITDylibSearchOrder &O) { Order = O; });
+    return ES->lookup(Order, Mangle(Name.str()));
+  }
+
+private:
+  // Point Name's stub at ImplName, which RT has just been given, and retire
+  // the body it pointed at before.
+  Error bindDefinition(const std::string &Name, const std::string &ImplName,
+                       ResourceTrackerSP RT) {
+    // compile it now, the stub needs its address
+    auto Impl = lookup(ImplName);
+    if (!Impl) {
+      cantFail(RT->remove());
+      return Impl.takeError();
+    }
+
+    auto Prev = DefinitionRTs.find(Name);
+    if (Prev == DefinitionRTs.end()) {
+      if (auto Err = ISM->createStub(Name, Impl->getAddress(),
+                                     JITSymbolFlags::Exported |
+                                         JITSymbolFlags::Callable))
+        return Err;
+      auto Stub = ISM->findStub(Name, /*ExportedStubsOnly*/ true);
+      if (auto Err = MainJD.define(absoluteSymbols({{Mangle(Name), Stub}})))
+        return Err;
+      DefinitionRTs[Name] = std::move(RT);
+      return Error::success();
+    }
+
+    // a host thread may be loading the pointer right now (GrokFunction)
+    auto *Ptr = ISM->findPointer(Name).getAddress().toPtr<void **>();
+    __atomic_store_n(Ptr, Impl->getAddress().toPtr<void *>(), __ATOMIC_SEQ_CST);
+    std::lock_guard<std::mutex> Lock(RetiredMutex);
+    Retired.push_back(std::move(Prev->second));
+    AnyRetired.store(true);
+    Prev->second = std::move(RT);
+    return freeRetiredLocked();
+  }
+
+  // Free the replaced bodies, unless a host call is running. Any call that
+  // starts after this check loads the new pointers, so it can't reach them.
+  // Otherwise the last of the running calls frees them in leaveCall.
+  // RetiredMutex must be held.
+  Error freeRetiredLocked() {
+    if (CallsInFlight.load() != 0)
+      return Error::success();
+    AnyRetired.store(false);
+    Error Err = Error::success();
+    for (auto &RT : Retired)
+      Err = joinErrors(std::move(Err), RT->remove());
+    Retired.clear();
+    return Err;
   }
 };
 
@@ -4,9 +4,12 @@
 #include <string>
 #include <vector>
 
+#include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Function.h>
 
+#include "stats.h"
+
 using namespace std;
 
 /*
@@ -27,9 +30,33 @@ using namespace std;
 class ExprAST
 {
 public:
+    ExprAST() { Stats.ASTNodes++; }
     // virtual: lets this destructor be overridden in derived classes
     virtual ~ExprAST() = default;
     virtual llvm::Value *codegen() = 0;
+
+    // codegen of a value used as a truth value (if, for, && and ||), see codegen.cpp
+    // codegenCond() gives an i1 that's true for anything but 0.0 (and NaN). comparisons
+    // hand over their fcmp as is instead of going to a double and back
+    virtual llvm::Value *codegenCond();
+    // branch to IfTrue or IfFalse on the truth value. && and || jump straight to the
+    // outcome without making an i1 first. returns false on error
+    virtual bool codegenBranch(llvm::BasicBlock *IfTrue, llvm::BasicBlock *IfFalse);
+
+    // interpreter tier (interp.cpp) - evaluate straight from the AST, no LLVM
+    // canInterpret() must return true before interpret() is called;
+    // it also resolves anything interpret() needs (ie. callee addresses)
+    virtual bool canInterpret() { return false; }
+    virtual double interpret() { return 0; }
+
+    // AST simplification (simplify.cpp) - constant folding, dead branches, identities
+    // returns a node to replace this one with, or nullptr to keep it
+    virtual unique_ptr<ExprAST> simplify() { return nullptr; }
+    // true (and sets V) if this node is a numeric literal
+    virtual bool isConstant(double &V) { return false; }
+    // true if this always has the same value inside a for loop over Var, and evaluating
+    // it has no side effects (so it can be computed once before the loop)
+    virtual bool isInvariantIn(const string &Var) { return false; }
 };
 
 // expression class for numeric literals ie. 1.0
@@ -40,6 +67,14 @@ class NumberExprAST : public ExprAST
 public:
     NumberExprAST(double Val) : Val(Val) {} // constructor that sets value of Val to parameter Val
     llvm::Value *codegen() override;
+    bool canInterpret() override;
+    double interpret() override;
+    bool isConstant(double &V) override
+    {
+        V = Val;
+        return true;
+    }
+    bool isInvariantIn(const string &Var) override { return true; }
 };
 
 class StringExprAST : public ExprAST
@@ -59,6 +94,8 @@ class VariableExprAST : public ExprAST
 public:
     VariableExprAST(const string &Name) : Name(Name) {}
     llvm::Value *codegen() override;
+    const string &getName() const { return Name; }
+    bool isInvariantIn(const string &Var) override { return Name != Var; }
 };
 
 // expression class for binary operators
@@ -66,15 +103,28 @@ public:
 class BinaryExprAST : public ExprAST
 {
     // unique_ptr smart pointer that owns/manages/disposes of its object when outside scope
-    char Op;
+    int Op; // a char or one of the lexer's operator tokens (tok_le, ...)
     unique_ptr<ExprAST> LHS, RHS;
 
 public:
-    BinaryExprAST(char Op, unique_ptr<ExprAST> LHS,
+    BinaryExprAST(int Op, unique_ptr<ExprAST> LHS,
                   unique_ptr<ExprAST> RHS)
         : Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
 
     llvm::Value *codegen() override;
+    llvm::Value *codegenCond() override;
+    bool codegenBranch(llvm::BasicBlock *IfTrue, llvm::BasicBlock *IfFalse) override;
+    bool canInterpret() override;
+    double interpret() override;
+    unique_ptr<ExprAST> simplify() override;
+
+    int getOp() const { return Op; }
+    ExprAST *getLHS() const { return LHS.get(); }
+    ExprAST *getRHS() const { return RHS.get(); }
+    bool isInvariantIn(const string &Var) override
+    {
+        return LHS->isInvariantIn(Var) && RHS->isInvariantIn(Var);
+    }
 };
 
 // expression class for function calls
@@ -82,6 +132,7 @@ class CallExprAST : public ExprAST
 {
     string Callee;
     vector<unique_ptr<ExprAST>> Args;
+    void *CalleeAddr = nullptr; // filled in by canInterpret()
 
 public:
     CallExprAST(const string &Callee,
@@ -89,6 +140,14 @@ public:
         : Callee(Callee), Args(std::move(Args)) {}
 
     llvm::Value *codegen() override;
+    // call to a generator, returns the coroutine handle (see ForEachExprAST)
+    llvm::Value *codegenGenerator();
+    bool canInterpret() override;
+    double interpret() override;
+    unique_ptr<ExprAST> simplify() override;
+
+private:
+    llvm::Value *codegenCall(llvm::Function *CalleeF);
 };
 
 // prototype for a function
@@ -97,6 +156,8 @@ class PrototypeAST
 {
     string Name;
     vector<string> Args;
+    bool Extern = false;    // declared with `extern`, ie. lives outside grok
+    bool Generator = false; // def with a yield in it, returns a coroutine handle instead of a double
 
 public:
     PrototypeAST(const string &Name, vector<string> Args)
@@ -104,19 +165,34 @@ public:
 
     llvm::Function *codegen();
     const string &getName() const { return Name; }
+    size_t getNumArgs() const { return Args.size(); }
+    const vector<string> &getArgs() const { return Args; }
+    bool isExtern() const { return Extern; }
+    void setExtern() { Extern = true; }
+    bool isGenerator() const { return Generator; }
+    void setGenerator() { Generator = true; }
 };
 
 // class representing function definition
 class FunctionAST
 {
     unique_ptr<PrototypeAST> Proto;
-    unique_ptr<ExprAST> Body;
+    shared_ptr<ExprAST> Body; // a generator's is shared with GeneratorBodies
 
 public:
     FunctionAST(unique_ptr<PrototypeAST> Proto, unique_ptr<ExprAST> Body)
         : Proto(std::move(Proto)), Body(std::move(Body)) {}
 
     llvm::Function *codegen();
+    void simplify(); // simplify the body, see simplify.cpp
+
+    // codegen() leaves the AST as it was, so it can be compiled again
+    // (ie. after a generator it has a copy of changed)
+    const PrototypeAST &getProto() const { return *Proto; }
+
+    // only for anon top-level exprs (no args), see interp.cpp
+    bool canInterpret() { return Body->canInterpret(); }
+    double interpret() { return Body->interpret(); }
 };
 
 // expression class AST node for if/then/else -> pointers to subexpressions
@@ -130,6 +206,9 @@ public:
         : Cond(std::move(Cond)), Then(std::move(Then)), Else(std::move(Else)) {}
 
     llvm::Value *codegen() override;
+    bool canInterpret() override;
+    double interpret() override;
+    unique_ptr<ExprAST> simplify() override;
 };
 
 class ForExprAST : public ExprAST
@@ -144,6 +223,35 @@ public:
           End(std::move(End)), Step(std::move(Step)), Body(std::move(Body)) {}
 
     llvm::Value *codegen() override;
+    unique_ptr<ExprAST> simplify() override;
+};
+
+// yield Val - hands Val to the for loop running the generator and waits to be resumed
+// evaluates to Val. only allowed in a def, which makes the def a generator
+class YieldExprAST : public ExprAST
+{
+    unique_ptr<ExprAST> Val;
+
+public:
+    YieldExprAST(unique_ptr<ExprAST> Val) : Val(std::move(Val)) {}
+
+    llvm::Value *codegen() override;
+    unique_ptr<ExprAST> simplify() override;
+};
+
+// for VarName = gen(args) in Body - runs Body once for every value the generator yields
+class ForEachExprAST : public ExprAST
+{
+    string VarName;
+    unique_ptr<CallExprAST> Seq;
+    unique_ptr<ExprAST> Body;
+
+public:
+    ForEachExprAST(const string &VarName, unique_ptr<CallExprAST> Seq, unique_ptr<ExprAST> Body)
+        : VarName(VarName), Seq(std::move(Seq)), Body(std::move(Body)) {}
+
+    llvm::Value *codegen() override;
+    unique_ptr<ExprAST> simplify() override;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+----PURPOSE:
+    Native C versions of the kernels in this directory, the "how fast could it be" baseline.
+    Same algorithms and sizes as the .grk files. Build with -O2.
+    grok's for loop tests its end condition after the body, so 'for i = 0, i < n' runs
+    i = 0..n; the loops here use i <= n to do the same work.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+// results go here so the compiler can't throw the work away
+static volatile double Sink;
+
+// same as the sinkd builtin the .grk loops hand each result to: an opaque call
+__attribute__((noinline)) static double sinkd(double x)
+{
+    Sink = x;
+    return 0;
+}
+
+static double fib(double n)
+{
+    return n < 2 ? 1 : fib(n - 1) + fib(n - 2);
+}
+
+static double loop(double n)
+{
+    for (double i = 0; i <= n; i += 1)
+        sinkd(sin(i));
+    return 0;
+}
+
+static double f(double x)
+{
+    return 4 / (1 + x * x);
+}
+
+static double integ(double a, double b, double n)
+{
+    if (n < 2)
+        return f((a + b) / 2) * (b - a);
+    return integ(a, (a + b) / 2, n / 2) + integ((a + b) / 2, b, n / 2);
+}
+
+static double poly(double x)
+{
+    return x * x + 3 * x + 1;
+}
+
+static double calls(double n)
+{
+    for (double i = 0; i <= n; i += 1)
+        sinkd(poly(i));
+    return 0;
+}
+
+static double now_ms()
+{
+    struct timespec T;
+    clock_gettime(CLOCK_MONOTONIC, &T);
+    return T.tv_sec * 1e3 + T.tv_nsec / 1e6;
+}
+
+// best of Reps runs, in ms
+static double best(double (*Kernel)(double), double Arg, int Reps)
+{
+    double Best = 1e300;
+    for (int i = 0; i < Reps; i++)
+    {
+        double Start = now_ms();
+        Sink = Kernel(Arg);
+        double T = now_ms() - Start;
+        if (T < Best)
+            Best = T;
+    }
+    return Best;
+}
+
+static double integ1m(double n)
+{
+    return integ(0, 1, n);
+}
+
+int main()
+{
+    const int Reps = 5;
+    printf("%-12s %12s\n", "kernel", "exec ms");
+    printf("%-12s %12.3f\n", "fib", best(fib, 25, Reps));
+    printf("%-12s %12.3f\n", "loop", best(loop, 1000000, Reps));
+    printf("%-12s %12.3f\n", "integrate", best(integ1m, 1048576, Reps));
+    printf("%-12s %12.3f\n", "calls", best(calls, 1000000, Reps));
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "codegen.h"
+#include "embed.h"
+#include "lexer.h"
+#include "parser.h"
+#include "toplevel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace llvm;
+using namespace llvm::orc;
+
+/*
+----PURPOSE:
+    Benchmark driver for the cgrok JIT. For each .grk kernel (defs + one final expression)
+    it reports, separately:
+        lex+parse   ParseDefinition()/ParseTopLevelExpr() (the lexer runs on demand inside them)
+        codegen     FunctionAST::codegen(), including the function pass pipeline
+        jit         addModule() + lookup() of the entry point (ORC compiles on lookup)
+        exec        best of N calls of the entry point
+    usage: bench [-r reps] kernel.grk...
+*/
+
+static double nowMs()
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct PhaseTimes
+{
+    double Parse = 0, Codegen = 0, JIT = 0, Exec = 0;
+};
+
+// compile and run one kernel, false on error
+static bool runKernel(const string &Src, int Reps, PhaseTimes &T)
+{
+    unique_ptr<FunctionAST> Entry;
+    double Start;
+
+    SetLexerSource(Src);
+    getNextToken();
+    while (CurTok != tok_eof)
+    {
+        switch (CurTok)
+        {
+        case ';':
+            getNextToken();
+            break;
+        case tok_def:
+        {
+            Start = nowMs();
+            auto FnAST = ParseDefinition();
+            T.Parse += nowMs() - Start;
+            if (!FnAST)
+                return false;
+
+            Start = nowMs();
+            Function *FnIR = FnAST->codegen();
+            T.Codegen += nowMs() - Start;
+            if (!FnIR)
+                return false;
+
+            Start = nowMs();
+            ExitOnErr(TheJIT->addDefinition(FnIR->getName(),
+                ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
+            T.JIT += nowMs() - Start;
+            InitializeModuleAndManagers();
+            break;
+        }
+        case tok_extern:
+        {
+            Start = nowMs();
+            auto ProtoAST = ParseExtern();
+            T.Parse += nowMs() - Start;
+            if (!ProtoAST || !ProtoAST->codegen())
+                return false;
+            FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+            break;
+        }
+        default:
+            Start = nowMs();
+            Entry = ParseTopLevelExpr("__bench_entry");
+            T.Parse += nowMs() - Start;
+            if (!Entry)
+                return false;
+            break;
+        }
+    }
+
+    if (!Entry)
+    {
+        LogError("kernel has no entry expression");
+        return false;
+    }
+
+    Start = nowMs();
+    bool Ok = Entry->codegen() != nullptr;
+    T.Codegen += nowMs() - Start;
+    FunctionProtos.erase("__bench_entry");
+    if (!Ok)
+        return false;
+
+    // everything is materialized on the first lookup, so that's the real JIT cost
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    Start = nowMs();
+    ExitOnErr(TheJIT->addModule(
+        ThreadSafeModule(std::move(TheModule), std::move(TheContext)), RT));
+    auto Sym = ExitOnErr(TheJIT->lookup("__bench_entry"));
+    T.JIT += nowMs() - Start;
+    InitializeModuleAndManagers();
+
+    double (*FP)() = Sym.getAddress().toPtr<double (*)()>();
+    T.Exec = 1e300;
+    for (int i = 0; i < Reps; i++)
+    {
+        Start = nowMs();
+        FP();
+        double Took = nowMs() - Start;
+        if (Took < T.Exec)
+            T.Exec = Took;
+    }
+
+    ExitOnErr(RT->remove());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int Reps = 5;
+    vector<string> Files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            Reps = atoi(argv[++i]);
+        else
+            Files.push_back(argv[i]);
+    }
+    if (Files.empty())
+    {
+        fprintf(stderr, "usage: %s [-r reps] kernel.grk...\n", argv[0]);
+        return 1;
+    }
+
+    if (!GrokInitialize())
+        return 1;
+
+    printf("%-12s %12s %12s %12s %12s\n", "kernel", "lex+parse ms", "codegen ms", "jit ms", "exec ms");
+    for (auto &File : Files)
+    {
+        ifstream In(File);
+        if (!In)
+        {
+            fprintf(stderr, "Error: could not open %s\n", File.c_str());
+            return 1;
+        }
+        stringstream SS;
+        SS << In.rdbuf();
+        string Src = SS.str();
+
+        // kernel name = file name without directory or extension
+        string Name = File.substr(File.find_last_of('/') + 1);
+        Name = Name.substr(0, Name.find('.'));
+
+        PhaseTimes T;
+        if (!runKernel(Src, Reps, T))
+        {
+            fprintf(stderr, "Error: kernel %s failed\n", Name.c_str());
+            return 1;
+        }
+        printf("%-12s %12.3f %12.3f %12.3f %12.3f\n", Name.c_str(), T.Parse, T.Codegen, T.JIT, T.Exec);
+    }
+    SetLexerStdin();
+    return 0;
+}
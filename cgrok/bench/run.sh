@@ -0,0 +1,32 @@
+#!/bin/sh
+# Builds and runs the benchmark suite:
+#   cgrok JIT (bench.cpp)  - every phase, on every kernel in this directory
+#   native C (baseline.c)  - execution only, same kernels
+#   pygrok / llvmlite      - kernels that pygrok can express (pygrok/bench), if llvmlite is installed
+# usage: sh run.sh [reps]
+# results are also written to bench_output.txt for comparing between builds
+set -e
+cd "$(dirname "$0")"
+REPS=${1:-5}
+OUT=_build
+mkdir -p $OUT
+
+clang++ -O2 -Xlinker --export-dynamic -I.. bench.cpp \
+    ../lexer.cpp ../parser.cpp ../codegen.cpp ../toplevel.cpp ../runtime.cpp ../embed.cpp ../interp.cpp ../simplify.cpp ../stats.cpp ../jitevents.cpp ../host.cpp ../watch.cpp ../grkc.cpp ../import.cpp ../input.cpp \
+    `llvm-config --cxxflags --ldflags --system-libs --libs core orcjit native asmparser bitreader bitwriter` -o $OUT/bench
+clang -O2 baseline.c -lm -o $OUT/baseline
+
+{
+    echo "== cgrok JIT =="
+    $OUT/bench -r $REPS fib.grk loop.grk integrate.grk calls.grk 2>/dev/null
+    echo
+    echo "== native C =="
+    $OUT/baseline
+    echo
+    echo "== pygrok (llvmlite) =="
+    if python3 -c "import llvmlite" 2>/dev/null; then
+        (cd ../../pygrok && python3 bench.py -r $REPS bench/fib.grk)
+    else
+        echo "llvmlite not installed, skipped"
+    fi
+} | tee bench_output.txt
@@ -2,6 +2,7 @@
 #include "parser.h"
 #include "ast.h"
 #include "lexer.h"
+#include "host.h"
 
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
@@ -10,6 +11,7 @@
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
@@ -25,8 +27,10 @@
 #include "llvm/Transforms/Scalar/Reassociate.h"
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
 
+#include <cmath>
 #include <memory>
 #include <map>
+#include <set>
 
 using namespace std;
 using namespace llvm;
@@ -61,6 +65,31 @@ unique_ptr<StandardInstrumentations> TheSI;
 map<string, unique_ptr<PrototypeAST>> FunctionProtos;
 ExitOnError ExitOnErr;
 
+// floating point mode for everything the builder emits, strict unless asked for (--fp-mode)
+static FPMode TheFPMode = FP_STRICT;
+
+void SetFPMode(FPMode Mode)
+{
+    TheFPMode = Mode;
+}
+
+FastMathFlags GetFastMathFlags()
+{
+    FastMathFlags FMF;
+    switch (TheFPMode)
+    {
+    case FP_STRICT:
+        break;
+    case FP_CONTRACT:
+        FMF.setAllowContract(true);
+        break;
+    case FP_FAST:
+        FMF.setFast();
+        break;
+    }
+    return FMF;
+}
+
 // reports errors found during code generation
 Value *LogErrorV(const char *Str)
 {
@@ -68,6 +97,8 @@ Value *LogErrorV(const char *Str)
     return nullptr;
 }
 
+static Function *emitGeneratorCopy(const string &Name);
+
 // convenience method, just calls TheModule->getFunction() if it finds an existing function def
 // if not, try to generate one or else return null
 Function *getFunction(string Name)
@@ -77,6 +108,14 @@ Function *getFunction(string Name)
     if (auto *F = TheModule->getFunction(Name))
         return F;
 
+    // host functions with an IR body get that body, so calls can be inlined
+    if (auto *F = EmitHostFunctionBody(Name))
+        return F;
+
+    // so do generators, so for loops over them can inline the coroutine
+    if (auto *F = emitGeneratorCopy(Name))
+        return F;
+
     // if not, check whether we can codegen declaration from prototype
     auto FI = FunctionProtos.find(Name);
     if (FI != FunctionProtos.end())
@@ -111,7 +150,7 @@ Value *NumberExprAST::codegen()
 Value *StringExprAST::codegen()
 {
     // fprintf(stderr, "Parsed a string.");
-    return ConstantDataArray::getString(*TheContext, StringRef(StrVal));
+    return ConstantDataArray::getString(*TheContext, StringRef(Val));
 }
 
 // codegen for variables
@@ -125,8 +164,36 @@ Value *VariableExprAST::codegen()
 }
 
 // code generation for binary expressions
+// comparisons and && || - their result is a truth value, see codegenCond()
+static bool isCondOp(int Op)
+{
+    switch (Op)
+    {
+    case '<':
+    case '>':
+    case tok_le:
+    case tok_ge:
+    case tok_eq:
+    case tok_ne:
+    case tok_and:
+    case tok_or:
+        return true;
+    default:
+        return false;
+    }
+}
+
 Value *BinaryExprAST::codegen()
 {
+    // convert bool to double 0.0 or 1.0.
+    if (isCondOp(Op))
+    {
+        Value *C = codegenCond();
+        if (!C)
+            return nullptr;
+        return Builder->CreateUIToFP(C, Type::getDoubleTy(*TheContext), "booltmp");
+    }
+
     // L and R must have the same type
     // resulting type must match as well.
 
@@ -153,26 +220,183 @@ Value *BinaryExprAST::codegen()
         return Builder->CreateFDiv(L, R, "divtmp");
     case '%':
         return Builder->CreateFRem(L, R, "remtmp");
-    case '<':
-        L = Builder->CreateFCmpULT(L, R, "cmptmp");
-        // convert bool to double 0.0 or 1.0.
-        return Builder->CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
-    case '>':
-        L = Builder->CreateFCmpUGT(L, R, "cmptmp");
-        return Builder->CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
     default:
         return LogErrorV("invalid binary operator: ");
     }
 }
 
+// truth value of anything: compare non-eq to 0.0
+Value *ExprAST::codegenCond()
+{
+    Value *V = codegen();
+    if (!V)
+        return nullptr;
+    return Builder->CreateFCmpONE(V, ConstantFP::get(*TheContext, APFloat(0.0)), "tobool");
+}
+
+bool ExprAST::codegenBranch(BasicBlock *IfTrue, BasicBlock *IfFalse)
+{
+    Value *C = codegenCond();
+    if (!C)
+        return false;
+    Builder->CreateCondBr(C, IfTrue, IfFalse);
+    return true;
+}
+
+Value *BinaryExprAST::codegenCond()
+{
+    if (Op == tok_and || Op == tok_or)
+    {
+        // the right side only runs if the left doesn't decide it:
+        //   a && b -> a ? b : false        a || b -> a ? true : b
+        Value *L = LHS->codegenCond();
+        if (!L)
+            return nullptr;
+
+        Function *TheFunction = Builder->GetInsertBlock()->getParent();
+        BasicBlock *LhsBB = Builder->GetInsertBlock();
+        BasicBlock *RhsBB = BasicBlock::Create(*TheContext, Op == tok_and ? "and.rhs" : "or.rhs", TheFunction);
+        BasicBlock *MergeBB = BasicBlock::Create(*TheContext, Op == tok_and ? "and.end" : "or.end");
+        if (Op == tok_and)
+            Builder->CreateCondBr(L, RhsBB, MergeBB);
+        else
+            Builder->CreateCondBr(L, MergeBB, RhsBB);
+
+        Builder->SetInsertPoint(RhsBB);
+        Value *R = RHS->codegenCond();
+        if (!R)
+            return nullptr;
+        Builder->CreateBr(MergeBB);
+        RhsBB = Builder->GetInsertBlock(); // RHS may have added blocks
+
+        TheFunction->insert(TheFunction->end(), MergeBB);
+        Builder->SetInsertPoint(MergeBB);
+        PHINode *PN = Builder->CreatePHI(Type::getInt1Ty(*TheContext), 2, Op == tok_and ? "andtmp" : "ortmp");
+        PN->addIncoming(Op == tok_and ? Builder->getFalse() : Builder->getTrue(), LhsBB);
+        PN->addIncoming(R, RhsBB);
+        return PN;
+    }
+
+    if (!isCondOp(Op))
+        return ExprAST::codegenCond();
+
+    Value *L = LHS->codegen();
+    Value *R = RHS->codegen();
+    if (!L || !R)
+        return nullptr;
+
+    // < and > are unordered (true for NaN), == is ordered, != unordered
+    switch (Op)
+    {
+    case '<':
+        return Builder->CreateFCmpULT(L, R, "cmptmp");
+    case '>':
+        return Builder->CreateFCmpUGT(L, R, "cmptmp");
+    case tok_le:
+        return Builder->CreateFCmpULE(L, R, "cmptmp");
+    case tok_ge:
+        return Builder->CreateFCmpUGE(L, R, "cmptmp");
+    case tok_eq:
+        return Builder->CreateFCmpOEQ(L, R, "cmptmp");
+    default: // tok_ne
+        return Builder->CreateFCmpUNE(L, R, "cmptmp");
+    }
+}
+
+bool BinaryExprAST::codegenBranch(BasicBlock *IfTrue, BasicBlock *IfFalse)
+{
+    if (Op != tok_and && Op != tok_or)
+        return ExprAST::codegenBranch(IfTrue, IfFalse);
+
+    // each side branches to the outcome it decides, no i1 gets built
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *RhsBB = BasicBlock::Create(*TheContext, Op == tok_and ? "and.rhs" : "or.rhs", TheFunction);
+    bool Ok = Op == tok_and ? LHS->codegenBranch(RhsBB, IfFalse)
+                            : LHS->codegenBranch(IfTrue, RhsBB);
+    if (!Ok)
+        return false;
+
+    Builder->SetInsertPoint(RhsBB);
+    return RHS->codegenBranch(IfTrue, IfFalse);
+}
+
+// libm functions LLVM has intrinsics for, with their arg counts
+// calling one of these through an extern emits the intrinsic instead, which LLVM
+// can constant fold, vectorize and usually lower to a single instruction
+static const map<string, pair<Intrinsic::ID, unsigned>> MathIntrinsics = {
+    {"sqrt", {Intrinsic::sqrt, 1}},
+    {"sin", {Intrinsic::sin, 1}},
+    {"cos", {Intrinsic::cos, 1}},
+    {"exp", {Intrinsic::exp, 1}},
+    {"exp2", {Intrinsic::exp2, 1}},
+    {"log", {Intrinsic::log, 1}},
+    {"log2", {Intrinsic::log2, 1}},
+    {"log10", {Intrinsic::log10, 1}},
+    {"fabs", {Intrinsic::fabs, 1}},
+    {"floor", {Intrinsic::floor, 1}},
+    {"ceil", {Intrinsic::ceil, 1}},
+    {"trunc", {Intrinsic::trunc, 1}},
+    {"round", {Intrinsic::round, 1}},
+    {"rint", {Intrinsic::rint, 1}},
+    {"nearbyint", {Intrinsic::nearbyint, 1}},
+    {"pow", {Intrinsic::pow, 2}},
+    {"copysign", {Intrinsic::copysign, 2}},
+    {"fmin", {Intrinsic::minnum, 2}},
+    {"fmax", {Intrinsic::maxnum, 2}},
+    {"fma", {Intrinsic::fma, 3}},
+};
+
+// the intrinsic to use for a call to Name, or not_intrinsic if it's a normal call
+// only externs count - a grok def named sin is just a function
+static Intrinsic::ID getMathIntrinsic(const string &Name, size_t NumArgs)
+{
+    auto MI = MathIntrinsics.find(Name);
+    if (MI == MathIntrinsics.end() || MI->second.second != NumArgs)
+        return Intrinsic::not_intrinsic;
+    auto FI = FunctionProtos.find(Name);
+    if (FI == FunctionProtos.end() || !FI->second->isExtern() || FI->second->getNumArgs() != NumArgs)
+        return Intrinsic::not_intrinsic;
+    return MI->second.first;
+}
+
 // code generation for functions
 Value *CallExprAST::codegen()
 {
+    if (Intrinsic::ID ID = getMathIntrinsic(Callee, Args.size()))
+    {
+        std::vector<Value *> ArgsV;
+        for (auto &Arg : Args)
+        {
+            ArgsV.push_back(Arg->codegen());
+            if (!ArgsV.back())
+                return nullptr;
+        }
+
+        // picks up the FP mode's fast-math flags from the builder
+        return Builder->CreateIntrinsic(ID, {Type::getDoubleTy(*TheContext)}, ArgsV, nullptr, "calltmp");
+    }
+
     // look up name in global module table
     Function *CalleeF = getFunction(Callee);
     if (!CalleeF)
         return LogErrorV("Unknown function referenced: ");
+    if (!CalleeF->getReturnType()->isDoubleTy())
+        return LogErrorV("A generator can only be called by a for loop (for x = gen() in ...)");
+    return codegenCall(CalleeF);
+}
 
+Value *CallExprAST::codegenGenerator()
+{
+    Function *CalleeF = getFunction(Callee);
+    if (!CalleeF)
+        return LogErrorV("Unknown function referenced: ");
+    if (!CalleeF->getReturnType()->isPointerTy())
+        return LogErrorV("for x = f() needs f to be a generator (a def with a yield in it)");
+    return codegenCall(CalleeF);
+}
+
+Value *CallExprAST::codegenCall(Function *CalleeF)
+{
     // if arg mismatch error
     if (CalleeF->arg_size() != Args.size())
         return LogErrorV("Incorrect # arguments passed.");
@@ -192,23 +416,20 @@ Value *CallExprAST::codegen()
 
 Value *IfExprAST::codegen()
 {
-    Value *CondV = Cond->codegen();
-    if (!CondV)
-        return nullptr;
-    // convert condition to bool by comparing non-eq to 0.0
-    // emit expression for condition, compare that value to 0 to get truth value as a 1 or 0
-    CondV = Builder->CreateFCmpONE(CondV, ConstantFP::get(*TheContext, APFloat(0.0)), "ifcond");
-
     Function *TheFunction = Builder->GetInsertBlock()->getParent(); // parent of current block is the function it goes into
 
-    // create blocks for then and else, insert "then" block at end of function
-    BasicBlock *ThenBB = BasicBlock::Create(*TheContext, "then", TheFunction);
+    // create blocks for then and else
+    BasicBlock *ThenBB = BasicBlock::Create(*TheContext, "then");
     BasicBlock *ElseBB = BasicBlock::Create(*TheContext, "else");
     BasicBlock *MergeBB = BasicBlock::Create(*TheContext, "ifcont");
 
-    Builder->CreateCondBr(CondV, ThenBB, ElseBB);
+    // branch on the condition straight away - a comparison's fcmp feeds the branch,
+    // && and || jump to then/else as soon as one side decides
+    if (!Cond->codegenBranch(ThenBB, ElseBB))
+        return nullptr;
 
-    // emit then value
+    // emit then value, insert "then" block at end of function
+    TheFunction->insert(TheFunction->end(), ThenBB);
     Builder->SetInsertPoint(ThenBB);
 
     Value *ThenV = Then->codegen();
@@ -244,8 +465,153 @@ Value *IfExprAST::codegen()
     return PN;
 }
 
+// ----------------------------------------------------------------------------------------------
+// COUNTED LOOPS ================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// a counted loop: the variable starts at a whole number and steps by a constant whole number
+// towards a bound that doesn't change inside the loop (for i = 0, i < n, 2 in ...).
+// these get an i64 induction variable, which scalar evolution can compute trip counts for,
+// so the loop passes can unroll and vectorize them. doubles up to 2^53 are exact integers,
+// so the body sees the same values it would with a double counter
+#define COUNTED_LOOP_MAX 9007199254740992.0 // 2^53
+
+struct CountedLoop
+{
+    int64_t Start, Step;
+    CmpInst::Predicate Pred; // keep looping while iv Pred bound
+    ExprAST *Bound;
+    bool RoundUp; // integer bound is ceil(Bound) (else floor)
+};
+
+static bool isWholeNumber(ExprAST *E, int64_t &N)
+{
+    double V;
+    if (!E->isConstant(V) || V != trunc(V) || fabs(V) > COUNTED_LOOP_MAX)
+        return false;
+    N = (int64_t)V;
+    return true;
+}
+
+static bool matchCountedLoop(const string &Var, ExprAST *Start, ExprAST *End, ExprAST *Step, CountedLoop &CL)
+{
+    if (!isWholeNumber(Start, CL.Start))
+        return false;
+    CL.Step = 1;
+    if (Step && (!isWholeNumber(Step, CL.Step) || CL.Step == 0))
+        return false;
+
+    // End has to be `Var op bound` (or `bound op Var`)
+    auto *Cmp = dynamic_cast<BinaryExprAST *>(End);
+    if (!Cmp)
+        return false;
+    int Op = Cmp->getOp();
+    auto *L = dynamic_cast<VariableExprAST *>(Cmp->getLHS());
+    auto *R = dynamic_cast<VariableExprAST *>(Cmp->getRHS());
+    if (L && L->getName() == Var && Cmp->getRHS()->isInvariantIn(Var))
+        CL.Bound = Cmp->getRHS();
+    else if (R && R->getName() == Var && Cmp->getLHS()->isInvariantIn(Var))
+    {
+        CL.Bound = Cmp->getLHS();
+        // bound < i is i > bound (the unordered compares flip exactly)
+        switch (Op)
+        {
+        case '<': Op = '>'; break;
+        case '>': Op = '<'; break;
+        case tok_le: Op = tok_ge; break;
+        case tok_ge: Op = tok_le; break;
+        }
+    }
+    else
+        return false;
+
+    // for whole numbers i: i < x is i < ceil(x), i <= x is i <= floor(x), ...
+    // and the step has to head towards the bound
+    switch (Op)
+    {
+    case '<':
+        CL.Pred = CmpInst::ICMP_SLT;
+        CL.RoundUp = true;
+        return CL.Step > 0;
+    case tok_le:
+        CL.Pred = CmpInst::ICMP_SLE;
+        CL.RoundUp = false;
+        return CL.Step > 0;
+    case '>':
+        CL.Pred = CmpInst::ICMP_SGT;
+        CL.RoundUp = false;
+        return CL.Step < 0;
+    case tok_ge:
+        CL.Pred = CmpInst::ICMP_SGE;
+        CL.RoundUp = true;
+        return CL.Step < 0;
+    default:
+        return false;
+    }
+}
+
+// same loop as ForExprAST::codegen() - body first, then the end test on the variable's current
+// value - with the counter in an i64 and the bound worked out once, before the loop
+static Value *codegenCountedLoop(const string &VarName, ExprAST &Body, const CountedLoop &CL)
+{
+    Type *Int64 = Type::getInt64Ty(*TheContext);
+    Type *Double = Type::getDoubleTy(*TheContext);
+
+    Value *BoundV = CL.Bound->codegen();
+    if (!BoundV)
+        return nullptr;
+
+    // the compares are unordered, a NaN bound never stops the loop
+    // (clamped, like any bound past 2^53 - the largest counter a double holds exactly)
+    Value *Rounded = Builder->CreateUnaryIntrinsic(CL.RoundUp ? Intrinsic::ceil : Intrinsic::floor, BoundV);
+    Value *IsNaN = Builder->CreateFCmpUNO(BoundV, BoundV, "isnan");
+    Value *Endless = ConstantFP::get(Double, CL.Step > 0 ? COUNTED_LOOP_MAX : -COUNTED_LOOP_MAX);
+    Rounded = Builder->CreateSelect(IsNaN, Endless, Rounded);
+    Rounded = Builder->CreateMaxNum(Rounded, ConstantFP::get(Double, -COUNTED_LOOP_MAX));
+    Rounded = Builder->CreateMinNum(Rounded, ConstantFP::get(Double, COUNTED_LOOP_MAX));
+    Value *Bound = Builder->CreateFPToSI(Rounded, Int64, "bound");
+
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *PreheaderBB = Builder->GetInsertBlock();
+    BasicBlock *LoopBB = BasicBlock::Create(*TheContext, "loop", TheFunction);
+    Builder->CreateBr(LoopBB);
+    Builder->SetInsertPoint(LoopBB);
+
+    PHINode *IV = Builder->CreatePHI(Int64, 2, VarName + ".iv");
+    IV->addIncoming(ConstantInt::get(Int64, CL.Start), PreheaderBB);
+
+    // the body sees a double (dead if it doesn't use the variable)
+    Value *OldVal = NamedValues[VarName];
+    NamedValues[VarName] = Builder->CreateSIToFP(IV, Double, VarName);
+
+    if (!Body.codegen())
+        return nullptr;
+
+    // can't overflow: |iv| stays within 2^53 + |step|
+    Value *NextIV = Builder->CreateNSWAdd(IV, ConstantInt::get(Int64, CL.Step), "nextvar");
+    Value *EndCond = Builder->CreateICmp(CL.Pred, IV, Bound, "loopcond");
+
+    BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+    BasicBlock *AfterBB = BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+    Builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+    Builder->SetInsertPoint(AfterBB);
+    IV->addIncoming(NextIV, LoopEndBB);
+
+    if (OldVal)
+        NamedValues[VarName] = OldVal;
+    else
+        NamedValues.erase(VarName);
+
+    return Constant::getNullValue(Double);
+}
+
 Value *ForExprAST::codegen()
 {
+    CountedLoop CL;
+    if (matchCountedLoop(VarName, Start.get(), End.get(), Step.get(), CL))
+        return codegenCountedLoop(VarName, *Body, CL);
+
+    // anything else keeps a double counter and evaluates End every time around
     // emit start code first without 'variable' (starting value) in scope
     Value *StartVal = Start->codegen();
     if (!StartVal)
@@ -294,14 +660,11 @@ Value *ForExprAST::codegen()
     }
 
     Value *NextVar = Builder->CreateFAdd(Variable, StepVal, "nextvar");
-    Value *EndCond = End->codegen();
+    // i1 straight from the comparison (one branch back to the loop, for the phi)
+    Value *EndCond = End->codegenCond();
     if (!EndCond)
         return nullptr;
 
-    // convert condition to bool by comparing non-eq to 0.0
-    EndCond = Builder->CreateFCmpONE(
-        EndCond, ConstantFP::get(*TheContext, APFloat(0.0)), "loopcond");
-
     // eval exit value of loop to determine if exit - like if/then/else
     // create after loop block and insert
     BasicBlock *LoopEndBB = Builder->GetInsertBlock();
@@ -326,19 +689,282 @@ Value *ForExprAST::codegen()
     return Constant::getNullValue(Type::getDoubleTy(*TheContext));
 }
 
+// ----------------------------------------------------------------------------------------------
+// GENERATORS ===================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// a def with a yield in it is a generator. calling one creates an LLVM coroutine (switch lowered,
+// see https://llvm.org/docs/Coroutines.html) and returns its handle. the call runs the body up to
+// its first yield, each resume runs it to the next one. yield stores its value in the coroutine's
+// promise, where the for loop reads it from. running off the end of the body parks it at its
+// final suspend point, which ends the loop.
+// every module with a for loop over a generator gets a private copy of the generator's body.
+// inlined into the loop, the coroutine's frame goes on the stack (CoroElide) and the resumes
+// become direct calls, so a generator costs about as much as writing the loop by hand
+
+map<string, shared_ptr<ExprAST>> GeneratorBodies;
+set<string> ModuleGenerators;
+
+void ProtoUndo::save(const string &Name)
+{
+    if (Old.count(Name))
+        return;
+    Saved &S = Old[Name];
+    auto P = FunctionProtos.find(Name);
+    if (P != FunctionProtos.end())
+        S.Proto = make_unique<PrototypeAST>(*P->second);
+    // whatever replaces the proto replaces the body too (or makes it a non-generator)
+    auto G = GeneratorBodies.find(Name);
+    if (G != GeneratorBodies.end())
+    {
+        S.GeneratorBody = std::move(G->second);
+        GeneratorBodies.erase(G);
+    }
+}
+
+void ProtoUndo::restore()
+{
+    for (auto &[Name, S] : Old)
+    {
+        if (S.Proto)
+            FunctionProtos[Name] = std::move(S.Proto);
+        else
+            FunctionProtos.erase(Name);
+        if (S.GeneratorBody)
+            GeneratorBodies[Name] = std::move(S.GeneratorBody);
+        else
+            GeneratorBodies.erase(Name);
+    }
+    Old.clear();
+}
+
+#define PROMISE_ALIGN 8 // of the promise (a double), the loop needs it to find the promise
+
+// the generator whose body is being emitted (null outside of one)
+struct GeneratorState
+{
+    Value *Id;           // coro.id token
+    Value *Handle;
+    Value *Promise;      // where yielded values go
+    BasicBlock *Cleanup; // destroyed: free the frame
+    BasicBlock *Suspend; // return to whoever resumed it
+};
+
+static GeneratorState *CurGenerator = nullptr;
+
+// emit Body as coroutine F, declared from a generator prototype
+static bool emitGenerator(Function *F, ExprAST &Body)
+{
+    Type *Double = Type::getDoubleTy(*TheContext);
+    Type *Int64 = Type::getInt64Ty(*TheContext);
+    PointerType *Ptr = PointerType::getUnqual(*TheContext);
+    F->setPresplitCoroutine();
+
+    BasicBlock *EntryBB = BasicBlock::Create(*TheContext, "entry", F);
+    BasicBlock *AllocBB = BasicBlock::Create(*TheContext, "coro.alloc", F);
+    BasicBlock *BeginBB = BasicBlock::Create(*TheContext, "coro.begin", F);
+    GeneratorState G;
+    G.Cleanup = BasicBlock::Create(*TheContext, "coro.cleanup");
+    G.Suspend = BasicBlock::Create(*TheContext, "coro.suspend");
+
+    Builder->SetInsertPoint(EntryBB);
+    AllocaInst *Promise = Builder->CreateAlloca(Double, nullptr, "promise");
+    Promise->setAlignment(Align(PROMISE_ALIGN));
+    G.Promise = Promise;
+    G.Id = Builder->CreateIntrinsic(Intrinsic::coro_id, {},
+                                    {Builder->getInt32(0), Promise, ConstantPointerNull::get(Ptr),
+                                     ConstantPointerNull::get(Ptr)});
+
+    // the frame only needs the heap if CoroElide couldn't put it in the caller's frame
+    Value *NeedAlloc = Builder->CreateIntrinsic(Intrinsic::coro_alloc, {}, {G.Id});
+    Builder->CreateCondBr(NeedAlloc, AllocBB, BeginBB);
+
+    Builder->SetInsertPoint(AllocBB);
+    Value *Size = Builder->CreateIntrinsic(Intrinsic::coro_size, {Int64}, {});
+    FunctionCallee Malloc = TheModule->getOrInsertFunction("malloc", Ptr, Int64);
+    Value *Mem = Builder->CreateCall(Malloc, {Size}, "frame");
+    Builder->CreateBr(BeginBB);
+
+    Builder->SetInsertPoint(BeginBB);
+    PHINode *Frame = Builder->CreatePHI(Ptr, 2, "frame");
+    Frame->addIncoming(ConstantPointerNull::get(Ptr), EntryBB);
+    Frame->addIncoming(Mem, AllocBB);
+    G.Handle = Builder->CreateIntrinsic(Intrinsic::coro_begin, {}, {G.Id, Frame}, nullptr, "hdl");
+
+    NamedValues.clear();
+    for (auto &Arg : F->args())
+        NamedValues[string(Arg.getName())] = &Arg;
+
+    GeneratorState *Outer = CurGenerator;
+    CurGenerator = &G;
+    bool Ok = Body.codegen() != nullptr;
+    CurGenerator = Outer;
+    if (!Ok)
+        return false;
+
+    // the body's value is dropped, the end of it is the final suspend
+    Value *Final = Builder->CreateIntrinsic(Intrinsic::coro_suspend, {},
+                                            {ConstantTokenNone::get(*TheContext), Builder->getTrue()});
+    SwitchInst *SI = Builder->CreateSwitch(Final, G.Suspend, 1);
+    SI->addCase(Builder->getInt8(1), G.Cleanup);
+
+    F->insert(F->end(), G.Cleanup);
+    Builder->SetInsertPoint(G.Cleanup);
+    Value *FrameMem = Builder->CreateIntrinsic(Intrinsic::coro_free, {}, {G.Id, G.Handle});
+    FunctionCallee Free = TheModule->getOrInsertFunction("free", Builder->getVoidTy(), Ptr);
+    Builder->CreateCall(Free, {FrameMem});
+    Builder->CreateBr(G.Suspend);
+
+    F->insert(F->end(), G.Suspend);
+    Builder->SetInsertPoint(G.Suspend);
+    Builder->CreateIntrinsic(Intrinsic::coro_end, {},
+                             {G.Handle, Builder->getFalse(), ConstantTokenNone::get(*TheContext)});
+    Builder->CreateRet(G.Handle);
+    return true;
+}
+
+// a private copy of generator Name in TheModule, or nullptr if Name isn't a generator
+// (or its body isn't known, ie. it came from a .grkc - calls then go to its compiled code)
+static Function *emitGeneratorCopy(const string &Name)
+{
+    auto Body = GeneratorBodies.find(Name);
+    auto Proto = FunctionProtos.find(Name);
+    if (Body == GeneratorBodies.end() || Proto == FunctionProtos.end())
+        return nullptr;
+
+    Function *F = Proto->second->codegen();
+    F->setLinkage(GlobalValue::InternalLinkage);
+    ModuleGenerators.insert(Name);
+
+    // emitted in the middle of the caller's codegen
+    IRBuilderBase::InsertPointGuard Guard(*Builder);
+    auto CallerValues = NamedValues;
+    bool Ok = emitGenerator(F, *Body->second);
+    NamedValues = std::move(CallerValues);
+    return Ok ? F : nullptr; // the caller fails too, which drops the copy (dropGeneratorCopies())
+}
+
+// remove the generators copied into TheModule, after the function they were for failed
+static void dropGeneratorCopies()
+{
+    vector<Function *> Copies;
+    for (auto &Name : ModuleGenerators)
+        if (Function *F = TheModule->getFunction(Name))
+            if (F->hasLocalLinkage())
+                Copies.push_back(F);
+
+    // they can call each other
+    for (auto *F : Copies)
+        F->dropAllReferences();
+    for (auto *F : Copies)
+        F->eraseFromParent();
+    ModuleGenerators.clear();
+}
+
+Value *YieldExprAST::codegen()
+{
+    if (!CurGenerator)
+        return LogErrorV("yield outside a generator");
+
+    Value *V = Val->codegen();
+    if (!V)
+        return nullptr;
+    Builder->CreateStore(V, CurGenerator->Promise);
+
+    // 0: resumed, 1: destroyed, anything else: suspended (back to the caller)
+    Value *S = Builder->CreateIntrinsic(Intrinsic::coro_suspend, {},
+                                        {ConstantTokenNone::get(*TheContext), Builder->getFalse()});
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *ResumeBB = BasicBlock::Create(*TheContext, "resume", TheFunction);
+    SwitchInst *SI = Builder->CreateSwitch(S, CurGenerator->Suspend, 2);
+    SI->addCase(Builder->getInt8(0), ResumeBB);
+    SI->addCase(Builder->getInt8(1), CurGenerator->Cleanup);
+
+    Builder->SetInsertPoint(ResumeBB);
+    return V;
+}
+
+Value *ForEachExprAST::codegen()
+{
+    Value *Handle = Seq->codegenGenerator();
+    if (!Handle)
+        return nullptr;
+
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *CondBB = BasicBlock::Create(*TheContext, "each.cond", TheFunction);
+    BasicBlock *BodyBB = BasicBlock::Create(*TheContext, "each.body");
+    BasicBlock *AfterBB = BasicBlock::Create(*TheContext, "each.end");
+    Builder->CreateBr(CondBB);
+
+    // done once it's parked at its final suspend point
+    Builder->SetInsertPoint(CondBB);
+    Value *Done = Builder->CreateIntrinsic(Intrinsic::coro_done, {}, {Handle}, nullptr, "done");
+    Builder->CreateCondBr(Done, AfterBB, BodyBB);
+
+    TheFunction->insert(TheFunction->end(), BodyBB);
+    Builder->SetInsertPoint(BodyBB);
+    Value *Promise = Builder->CreateIntrinsic(Intrinsic::coro_promise, {},
+                                              {Handle, Builder->getInt32(PROMISE_ALIGN), Builder->getFalse()});
+    Value *OldVal = NamedValues[VarName];
+    NamedValues[VarName] = Builder->CreateLoad(Type::getDoubleTy(*TheContext), Promise, VarName);
+
+    if (!Body->codegen())
+        return nullptr;
+
+    Builder->CreateIntrinsic(Intrinsic::coro_resume, {}, {Handle});
+    Builder->CreateBr(CondBB);
+
+    // the only way out, and it destroys the coroutine - what CoroElide needs to see
+    TheFunction->insert(TheFunction->end(), AfterBB);
+    Builder->SetInsertPoint(AfterBB);
+    Builder->CreateIntrinsic(Intrinsic::coro_destroy, {}, {Handle});
+
+    if (OldVal)
+        NamedValues[VarName] = OldVal;
+    else
+        NamedValues.erase(VarName);
+
+    return Constant::getNullValue(Type::getDoubleTy(*TheContext));
+}
+
+// CoroSplit (which turns a coroutine into its ramp, resume and destroy functions) is a CGSCC pass,
+// the per-function pipeline can't run it. modules using coroutines go through the whole-module
+// pipeline instead, which also inlines generator copies into their loops and elides their frames
+static bool hasCoroutines(Module &M)
+{
+    for (auto &F : M)
+        if (F.isIntrinsic() && F.getName().starts_with("llvm.coro.") && !F.use_empty())
+            return true;
+    return false;
+}
+
+static void lowerCoroutines(Module &M)
+{
+    PassBuilder PB(TheJIT->getTargetMachine(), PipelineTuningOptions(), {}, GetPassTimingCallbacks());
+    ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+    MPM.run(M, *TheMAM);
+}
+
 // codegen() for functions
 // creates the function prototype but not body
 // works for extern stmts but not functions ('defined in another source file')
 Function *PrototypeAST::codegen()
 {
     // function type: double(double, double)
+    // a generator returns its coroutine handle
     vector<Type *> Doubles(Args.size(), Type::getDoubleTy(*TheContext));
-    FunctionType *FT = FunctionType::get(Type::getDoubleTy(*TheContext), Doubles, false); // creates FunctionType like "new"
+    Type *RetTy = Generator ? (Type *)PointerType::getUnqual(*TheContext) : Type::getDoubleTy(*TheContext);
+    FunctionType *FT = FunctionType::get(RetTy, Doubles, false); // creates FunctionType like "new"
 
     // external linkage means function may be defined outside current module, or callable by functions outside module
     // name is user-specified function name, used in symbol table
     Function *F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get()); // creates IR function for the prototype
 
+    // tell IR-level passes what the code will run on, so they use the full vector width
+    F->addFnAttr("target-cpu", TheJIT->getTargetCPU());
+    if (!TheJIT->getTargetFeatures().empty())
+        F->addFnAttr("target-features", TheJIT->getTargetFeatures());
+
     // set names for args
     unsigned Idx = 0;
     for (auto &Arg : F->args())
@@ -348,43 +974,107 @@ Function *PrototypeAST::codegen()
 }
 
 // generates function with body
+// hot reload recompiles the callers itself (see watch.cpp)
+static bool SignatureChangesAllowed = false;
+
+void AllowSignatureChanges(bool Allow)
+{
+    SignatureChangesAllowed = Allow;
+}
+
+bool CheckRedefinition(const PrototypeAST &New)
+{
+    if (SignatureChangesAllowed || !TheJIT->hasDefinition(New.getName()))
+        return true;
+    auto Old = FunctionProtos.find(New.getName());
+    if (Old == FunctionProtos.end())
+        return true;
+    if (Old->second->getNumArgs() != New.getNumArgs())
+    {
+        LogError(("Can't change the number of parameters of " + New.getName() +
+                  ", code compiled against it still calls it the old way").c_str());
+        return false;
+    }
+    if (Old->second->isGenerator() != New.isGenerator())
+    {
+        LogError(("Can't turn " + New.getName() + (New.isGenerator() ? " into a generator" : " into a plain def") +
+                  ", code compiled against it expects the other return type").c_str());
+        return false;
+    }
+    return true;
+}
+
 Function *FunctionAST::codegen()
 {
-    // transfer ownership of prototype to FunctionProtos map
-    // but keep reference for later
+    PhaseTimer T(PHASE_CODEGEN);
+
+    // FunctionProtos gets its own copy of the prototype, this AST can be compiled again
     auto &P = *Proto;
-    FunctionProtos[Proto->getName()] = std::move(Proto);
+    if (IsHostFunction(P.getName()))
+    {
+        LogErrorV("Can't redefine a host function.");
+        return nullptr;
+    }
+    if (!CheckRedefinition(P))
+        return nullptr;
+    // callers compiled from now on copy the new body, not the old generator's
+    GeneratorBodies.erase(P.getName());
+    FunctionProtos[P.getName()] = make_unique<PrototypeAST>(P);
     Function *TheFunction = getFunction(P.getName());
     if (!TheFunction)
         return nullptr;
 
-    // create new basic block to insert into
-    // basic blocks define control flow graph
-    BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
-    Builder->SetInsertPoint(BB);
-
-    // record function args in NamedValues map
-    NamedValues.clear();
-    for (auto &Arg : TheFunction->args())
-        NamedValues[string(Arg.getName())] = &Arg;
-
-    // add function args to NamedValues map, so they're accessible to VariableExprAST nodes
-    if (Value *RetVal = Body->codegen()) // use codegen() to create and store code from entry block
+    bool Ok;
+    if (P.isGenerator())
+        Ok = emitGenerator(TheFunction, *Body); // returns the coroutine handle
+    else
     {
-        // finish function
-        Builder->CreateRet(RetVal);
+        // create new basic block to insert into
+        // basic blocks define control flow graph
+        BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
+        Builder->SetInsertPoint(BB);
+
+        // record function args in NamedValues map
+        NamedValues.clear();
+        for (auto &Arg : TheFunction->args())
+            NamedValues[string(Arg.getName())] = &Arg;
+
+        // add function args to NamedValues map, so they're accessible to VariableExprAST nodes
+        Value *RetVal = Body->codegen(); // use codegen() to create and store code from entry block
+        if (RetVal)
+            Builder->CreateRet(RetVal); // finish function
+        Ok = RetVal != nullptr;
+    }
 
+    if (Ok)
+    {
         // validate generated code, check for consistency
         verifyFunction(*TheFunction); // provided by LLVM: consistency checks for compiler
 
+        // pull in the bodies of small host helpers before optimizing
+        InlineHostCalls(*TheFunction);
+
         // optimize the function
-        TheFPM->run(*TheFunction, *TheFAM);
+        {
+            PhaseTimer T(PHASE_OPTIMIZE);
+            TheFPM->run(*TheFunction, *TheFAM);
+            if (hasCoroutines(*TheModule))
+                lowerCoroutines(*TheModule);
+        }
+
+        Stats.FunctionsCompiled++;
+        Stats.IRInstructions += TheFunction->getInstructionCount();
+
+        // for loops over it compiled from now on get a copy of the body (see getFunction())
+        if (P.isGenerator())
+            GeneratorBodies[P.getName()] = Body;
 
         return TheFunction;
     }
 
     // error reading body, remove function -> allows user to retype if they fuck up
     TheFunction->eraseFromParent();
+    dropGeneratorCopies();
     return nullptr;
 
     // TODO: Bug!
@@ -23,11 +23,16 @@
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/IndVarSimplify.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Scalar/LoopUnrollPass.h"
 #include "llvm/Transforms/Scalar/Reassociate.h"
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
 
 #include <memory>
 #include <map>
+#include <set>
 
 using namespace std;
 using namespace llvm;
@@ -55,7 +60,51 @@ extern unique_ptr<StandardInstrumentations> TheSI;
 extern map<string, unique_ptr<PrototypeAST>> FunctionProtos;
 extern ExitOnError ExitOnErr;
 
+// bodies of the generators defined so far (see YieldExprAST), copied into every module
+// with a for loop over one
+extern map<string, shared_ptr<ExprAST>> GeneratorBodies;
+// generators copied into TheModule (cleared with it, see InitializeModuleAndManagers())
+extern set<string> ModuleGenerators;
+
+// remembers the FunctionProtos (and GeneratorBodies) entries a batch of defs and externs
+// replaces, ie. a library being imported, so a batch that fails can be taken back out
+class ProtoUndo
+{
+    struct Saved
+    {
+        unique_ptr<PrototypeAST> Proto; // null = there wasn't one
+        shared_ptr<ExprAST> GeneratorBody;
+    };
+    map<string, Saved> Old;
+
+public:
+    // call before Name's prototype is replaced, only the first call for a name counts
+    void save(const string &Name);
+    // put back everything saved
+    void restore();
+};
+
+// a def that's already in the JIT is called through its stub by code compiled against its
+// prototype, so redefining it with a different number of parameters, or turning it into a
+// generator or back (different return type), is an error (logged).
+// true if New can replace the current definition
+bool CheckRedefinition(const PrototypeAST &New);
+// skip that check, for when the caller recompiles everything that calls a changed def
+void AllowSignatureChanges(bool Allow);
+
 Value *LogErrorV(const char *Str);
 Function *getFunction(string Name);
 
+// floating point semantics of generated code, applied to every FP instruction the builder emits
+enum FPMode
+{
+    FP_STRICT,   // IEEE, exactly what the source says (default)
+    FP_CONTRACT, // a*b+c may be fused into an fma
+    FP_FAST,     // all fast-math flags: reassociation, approximate math, no NaN/inf/-0.0
+};
+
+// takes effect from the next module (InitializeModuleAndManagers())
+void SetFPMode(FPMode Mode);
+FastMathFlags GetFastMathFlags();
+
 #endif
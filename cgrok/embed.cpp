@@ -0,0 +1,258 @@
+#include "embed.h"
+#include "codegen.h"
+#include "parser.h"
+#include "lexer.h"
+#include "toplevel.h"
+#include "stats.h"
+#include "jitevents.h"
+#include "host.h"
+#include "import.h"
+
+#include "llvm/Support/TargetSelect.h"
+
+#include <mutex>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// EMBEDDING API ================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// guards all the global compiler state (TheModule, Builder, CurTok, ...)
+static mutex CompileMutex;
+
+// gives every compiled expression its own symbol
+static unsigned ExprCount = 0;
+
+// report a JIT error without killing the host like ExitOnErr would
+static bool logIfError(Error Err)
+{
+    if (!Err)
+        return false;
+    logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+    return true;
+}
+
+GrokExpr::~GrokExpr()
+{
+    // removing from the JIT is thread safe, no need for CompileMutex
+    logIfError(RT->remove());
+}
+
+double GrokExpr::call(const vector<double> &Args) const
+{
+    assert(Args.size() == NumArgs && "wrong number of arguments to grok expression");
+    GrokCallScope Scope;
+    return CallNative(Addr, Args.data(), NumArgs);
+}
+
+double GrokFunction::call(const vector<double> &Args) const
+{
+    assert(Args.size() == NumArgs && "wrong number of arguments to grok function");
+    GrokCallScope Scope;
+    return CallNative(getAddress(), Args.data(), NumArgs);
+}
+
+bool GrokFunction::isStale() const
+{
+    lock_guard<mutex> Lock(CompileMutex);
+    auto It = FunctionProtos.find(Name);
+    return It == FunctionProtos.end() || It->second->getNumArgs() != NumArgs || It->second->isGenerator();
+}
+
+bool GrokInitialize(const string &TargetCPU)
+{
+    static std::once_flag Once;
+    static bool Ok = false;
+
+    std::call_once(Once, [&]()
+    {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+        InitializeNativeTargetAsmParser();
+
+        InstallStdBinops();
+
+        auto JIT = KaleidoscopeJIT::Create(TargetCPU);
+        if (!JIT)
+        {
+            logAllUnhandledErrors(JIT.takeError(), errs(), "Error: ");
+            return;
+        }
+        TheJIT = std::move(*JIT);
+        InstallJITStats();
+        InstallJITEventListeners();
+        InstallHostBuiltins();
+
+        InitializeModuleAndManagers();
+        Ok = true;
+    });
+
+    return Ok;
+}
+
+// walk the source like MainLoop() does, but stop at the first error
+// CompileMutex must be held
+static unique_ptr<GrokExpr> compileLocked(const vector<string> &ArgNames)
+{
+    string Name = "__anon_expr_" + to_string(ExprCount++);
+    unique_ptr<FunctionAST> ExprFn;
+
+    getNextToken();
+    while (CurTok != tok_eof)
+    {
+        switch (CurTok)
+        {
+        case ';':
+            getNextToken();
+            break;
+        case tok_def:
+        {
+            // definitions are shared by everyone, a redefinition replaces the old one for all callers
+            auto FnAST = ParseDefinition();
+            if (!FnAST || !DefineFunction(std::move(FnAST)))
+                return nullptr;
+            break;
+        }
+        case tok_extern:
+        {
+            auto ProtoAST = ParseExtern();
+            if (!ProtoAST || !ProtoAST->codegen())
+                return nullptr;
+            FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+            break;
+        }
+        case tok_import:
+        {
+            string Name = ParseImport();
+            if (Name.empty() || !ImportLibrary(Name))
+                return nullptr;
+            break;
+        }
+        default:
+            if (ExprFn)
+            {
+                LogError("Only one top-level expression allowed per compile.");
+                return nullptr;
+            }
+            ExprFn = ParseTopLevelExpr(Name, ArgNames);
+            if (!ExprFn)
+                return nullptr;
+            break;
+        }
+    }
+
+    if (!ExprFn)
+    {
+        LogError("Expected an expression to compile.");
+        return nullptr;
+    }
+
+    Function *F = ExprFn->codegen();
+    // codegen() registers the anon proto, don't let those pile up
+    FunctionProtos.erase(Name);
+    if (!F)
+        return nullptr;
+
+    // own tracker per expression so the handle can free just its code
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+    bool Failed = logIfError(TheJIT->addModule(std::move(TSM), RT));
+    InitializeModuleAndManagers();
+    if (Failed)
+        return nullptr;
+
+    auto ExprSymbol = TheJIT->lookup(Name);
+    if (!ExprSymbol)
+    {
+        logAllUnhandledErrors(ExprSymbol.takeError(), errs(), "Error: ");
+        logIfError(RT->remove());
+        return nullptr;
+    }
+
+    return make_unique<GrokExpr>(Name, ArgNames.size(),
+                                 ExprSymbol->getAddress().toPtr<void *>(), std::move(RT));
+}
+
+unique_ptr<GrokExpr> GrokCompile(const string &Src, const vector<string> &ArgNames)
+{
+    if (ArgNames.size() > GROK_MAX_ARGS)
+    {
+        LogError("Too many arguments for a grok expression.");
+        return nullptr;
+    }
+
+    lock_guard<mutex> Lock(CompileMutex);
+    if (!TheJIT)
+    {
+        LogError("GrokInitialize() has not been called.");
+        return nullptr;
+    }
+
+    SetLexerSource(Src);
+    auto Result = compileLocked(ArgNames);
+    SetLexerStdin(); // don't hang on to Src
+    return Result;
+}
+
+unique_ptr<GrokFunction> GrokLookup(const string &Name)
+{
+    lock_guard<mutex> Lock(CompileMutex);
+    if (!TheJIT)
+    {
+        LogError("GrokInitialize() has not been called.");
+        return nullptr;
+    }
+
+    auto It = FunctionProtos.find(Name);
+    if (It == FunctionProtos.end())
+    {
+        LogError(("Unknown function " + Name).c_str());
+        return nullptr;
+    }
+    // returns a coroutine handle, only a for loop can run it
+    if (It->second->isGenerator())
+    {
+        LogError(("Can't call generator " + Name + " from the host").c_str());
+        return nullptr;
+    }
+    unsigned NumArgs = It->second->getNumArgs();
+    if (NumArgs > GROK_MAX_ARGS)
+    {
+        LogError("Too many arguments for a grok function.");
+        return nullptr;
+    }
+
+    // defs are called through their stub's pointer
+    if (auto Ptr = TheJIT->getDefinitionPointer(Name))
+        return make_unique<GrokFunction>(Name, NumArgs, Ptr->toPtr<void *const *>());
+    else
+        consumeError(Ptr.takeError());
+
+    // externs resolve to a fixed host address
+    auto Sym = TheJIT->lookup(Name);
+    if (!Sym)
+    {
+        logAllUnhandledErrors(Sym.takeError(), errs(), "Error: ");
+        return nullptr;
+    }
+    return make_unique<GrokFunction>(Name, NumArgs, Sym->getAddress().toPtr<void *>());
+}
+
+bool GrokRegisterFunction(const string &Name, unsigned NumArgs, void *Addr, const string &IRBody)
+{
+    if (NumArgs > GROK_MAX_ARGS)
+    {
+        LogError("Too many arguments for a grok function.");
+        return false;
+    }
+
+    lock_guard<mutex> Lock(CompileMutex);
+    if (!TheJIT)
+    {
+        LogError("GrokInitialize() has not been called.");
+        return false;
+    }
+    return RegisterHostFunction(Name, NumArgs, Addr, IRBody);
+}
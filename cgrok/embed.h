@@ -0,0 +1,131 @@
+#ifndef EMBED_H
+#define EMBED_H
+
+#include "codegen.h"
+#include "interp.h"
+
+#include <cassert>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+----PURPOSE:
+    Library API for embedding grok in a host program instead of running the stdin REPL.
+    1. GrokInitialize() once to set up the shared JIT
+    2. GrokCompile() a source string into a GrokExpr handle
+    3. call the handle as many times as you like, from any thread
+
+    Compiling is serialized (the compiler state in codegen.cpp/parser.cpp is global),
+    but each expression gets its own symbol name and ResourceTracker, so compiled
+    handles never collide and can be called concurrently without any locking.
+    Calls may run while another thread redefines a function they use: every call counts
+    itself in and out of the JIT (one atomic add each way), and a replaced body is only
+    freed by a redefinition that finds no calls running.
+    Don't mix these calls with MainLoop() - they share the lexer.
+*/
+
+// most parameters a compiled expression can take
+#define GROK_MAX_ARGS MAX_NATIVE_ARGS
+
+// counts a host call into JIT'd code, see KaleidoscopeJIT::enterCall()
+struct GrokCallScope
+{
+    GrokCallScope() { TheJIT->enterCall(); }
+    ~GrokCallScope() { TheJIT->leaveCall(); }
+};
+
+// a compiled top-level expression living in the JIT
+// destroying the handle frees its JIT'd code
+class GrokExpr
+{
+    string Name;
+    unsigned NumArgs;
+    void *Addr;
+    ResourceTrackerSP RT;
+
+public:
+    GrokExpr(string Name, unsigned NumArgs, void *Addr, ResourceTrackerSP RT)
+        : Name(std::move(Name)), NumArgs(NumArgs), Addr(Addr), RT(std::move(RT)) {}
+    ~GrokExpr();
+
+    GrokExpr(const GrokExpr &) = delete;
+    GrokExpr &operator=(const GrokExpr &) = delete;
+
+    const string &getName() const { return Name; }
+    unsigned getNumArgs() const { return NumArgs; }
+    void *getAddress() const { return Addr; }
+
+    // call as a native function, one double per parameter
+    template <typename... ArgTs>
+    double operator()(ArgTs... Args) const
+    {
+        assert(sizeof...(ArgTs) == NumArgs && "wrong number of arguments to grok expression");
+        GrokCallScope Scope;
+        return ((double (*)(decltype((double)Args)...))Addr)((double)Args...);
+    }
+
+    // same thing when the arg count is only known at runtime
+    double call(const vector<double> &Args) const;
+};
+
+// a def'd (or extern) grok function, resolved once so calls skip ORC lookups entirely.
+// calls load the function's stub pointer, so a redefinition is picked up automatically
+// (and the body a call loaded isn't freed under it, see GrokCallScope)
+class GrokFunction
+{
+    string Name;
+    unsigned NumArgs;
+    void *Fixed;      // externs never move, Ptr points here
+    void *const *Ptr; // for defs: the pointer the function's stub jumps through
+
+public:
+    GrokFunction(string Name, unsigned NumArgs, void *const *Ptr)
+        : Name(std::move(Name)), NumArgs(NumArgs), Fixed(nullptr), Ptr(Ptr) {}
+    GrokFunction(string Name, unsigned NumArgs, void *Addr)
+        : Name(std::move(Name)), NumArgs(NumArgs), Fixed(Addr), Ptr(&Fixed) {}
+
+    GrokFunction(const GrokFunction &) = delete;
+    GrokFunction &operator=(const GrokFunction &) = delete;
+
+    const string &getName() const { return Name; }
+    unsigned getNumArgs() const { return NumArgs; }
+    // the current body. only good until the function is redefined, unlike calls through the handle
+    void *getAddress() const { return __atomic_load_n(Ptr, __ATOMIC_ACQUIRE); }
+
+    template <typename... ArgTs>
+    double operator()(ArgTs... Args) const
+    {
+        assert(sizeof...(ArgTs) == NumArgs && "wrong number of arguments to grok function");
+        GrokCallScope Scope; // before loading the pointer
+        return ((double (*)(decltype((double)Args)...))getAddress())((double)Args...);
+    }
+
+    double call(const vector<double> &Args) const;
+
+    // true once the name no longer refers to a function the handle can call, ie. it was
+    // re-declared extern with other parameters. takes the compile lock, keep it off hot paths
+    bool isStale() const;
+};
+
+// initialize native target, std binops and the shared JIT. safe to call more than once
+// (call EnableGDBJITInterface()/EnablePerfSupport() from jitevents.h first to profile grok code)
+// TargetCPU pins the CPU code is compiled for, empty = this machine's CPU and features
+bool GrokInitialize(const string &TargetCPU = "");
+
+// compile Src - any number of defs/externs followed by one expression - into a callable handle.
+// ArgNames become the parameters of the expression, in order.
+// an expression with a for loop over a generator has its own copy of the generator, so it
+// keeps running the old one if the generator is redefined (defs get recompiled, handles don't)
+// returns nullptr (and logs to stderr) on error
+unique_ptr<GrokExpr> GrokCompile(const string &Src, const vector<string> &ArgNames = vector<string>());
+
+// get a handle to a function defined (or declared extern) by earlier GrokCompile() calls
+// returns nullptr (and logs to stderr) if there is no such function
+unique_ptr<GrokFunction> GrokLookup(const string &Name);
+
+// make a double(double...) host function callable from grok code, see host.h.
+// IRBody is an optional LLVM IR definition of @Name that gets inlined into callers
+bool GrokRegisterFunction(const string &Name, unsigned NumArgs, void *Addr, const string &IRBody = "");
+
+#endif
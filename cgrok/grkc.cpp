@@ -0,0 +1,397 @@
+#include "grkc.h"
+#include "codegen.h"
+#include "parser.h"
+#include "lexer.h"
+#include "toplevel.h"
+#include "stats.h"
+#include "host.h"
+#include "import.h"
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstring>
+#include <set>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// MODULE FILES =================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// file layout, integers are in host byte order (the magic catches a foreign one)
+//   "GRKC" u32 version
+//   str triple, str cpu, str features          str = u32 length + bytes
+//   u32 #imports, each: str resolved path
+//   u32 #protos, each: str name, u8 extern, u32 #args, #args * str arg name
+//   u32 #defs, each: str name, u64 bitcode offset, u64 bitcode size, u64 object offset, u64 object size
+//   blobs, each 16 byte aligned, offsets count from the first one
+// an object defines its function as <name>.grkc, see KaleidoscopeJIT::addDefinitionObject
+
+#define GRKC_ALIGN 16
+
+struct GrkcDef
+{
+    string Name;
+    SmallVector<char, 0> Bitcode;
+    SmallVector<char, 0> Object; // empty if not saved
+};
+
+// mapped module files, JITLink reads the objects straight out of them
+// (for a library that can be any time later, whenever a def is first used)
+static vector<unique_ptr<MemoryBuffer>> LoadedFiles;
+
+static void putU32(string &Out, uint32_t V) { Out.append((const char *)&V, sizeof V); }
+static void putU64(string &Out, uint64_t V) { Out.append((const char *)&V, sizeof V); }
+
+static void putStr(string &Out, StringRef S)
+{
+    putU32(Out, S.size());
+    Out.append(S.data(), S.size());
+}
+
+static size_t alignBlob(size_t N) { return (N + GRKC_ALIGN - 1) & ~(size_t)(GRKC_ALIGN - 1); }
+
+// cursor over a mapped module file, any read past the end just clears Ok
+struct GrkcReader
+{
+    StringRef Buf;
+    size_t Pos = 0;
+    bool Ok = true;
+
+    template <typename T>
+    T num()
+    {
+        T V = 0;
+        if (Pos + sizeof V > Buf.size())
+            Ok = false;
+        else
+            memcpy(&V, Buf.data() + Pos, sizeof V);
+        Pos += sizeof V;
+        return V;
+    }
+
+    StringRef str()
+    {
+        uint32_t N = num<uint32_t>();
+        if (!Ok || Pos + N > Buf.size())
+        {
+            Ok = false;
+            return "";
+        }
+        StringRef S = Buf.substr(Pos, N);
+        Pos += N;
+        return S;
+    }
+
+    // element count of a table whose entries take at least MinSize bytes each
+    // a count the rest of the file can't hold clears Ok and reads as 0, so a corrupt
+    // file can't make the loader allocate more than the file's size
+    uint32_t count(size_t MinSize)
+    {
+        uint32_t N = num<uint32_t>();
+        if (!Ok || N > (Buf.size() - Pos) / MinSize)
+        {
+            Ok = false;
+            return 0;
+        }
+        return N;
+    }
+};
+
+// native code for the def in M, compiled the same way the JIT would
+static bool emitObject(Module &M, SmallVectorImpl<char> &Out)
+{
+    raw_svector_ostream OS(Out);
+    legacy::PassManager PM;
+    if (TheJIT->getTargetMachine()->addPassesToEmitFile(PM, OS, nullptr, CodeGenFileType::ObjectFile))
+    {
+        LogError("Target can't emit object files.");
+        return false;
+    }
+    PM.run(M);
+    return true;
+}
+
+static bool writeModuleFile(const string &OutPath, const vector<string> &Imports,
+                            const vector<string> &ProtoNames, vector<GrkcDef> &Defs)
+{
+    string Header = GRKC_MAGIC;
+    putU32(Header, GRKC_VERSION);
+    TargetMachine *TM = TheJIT->getTargetMachine();
+    putStr(Header, TM->getTargetTriple().str());
+    putStr(Header, TheJIT->getTargetCPU());
+    putStr(Header, TheJIT->getTargetFeatures());
+
+    putU32(Header, Imports.size());
+    for (auto &Import : Imports)
+        putStr(Header, Import);
+
+    putU32(Header, ProtoNames.size());
+    for (auto &Name : ProtoNames)
+    {
+        auto &P = *FunctionProtos[Name];
+        putStr(Header, Name);
+        Header.push_back((P.isExtern() ? GRKC_EXTERN : 0) | (P.isGenerator() ? GRKC_GENERATOR : 0));
+        putU32(Header, P.getNumArgs());
+        for (auto &Arg : P.getArgs())
+            putStr(Header, Arg);
+    }
+
+    uint64_t Offset = 0;
+    putU32(Header, Defs.size());
+    for (auto &D : Defs)
+    {
+        putStr(Header, D.Name);
+        putU64(Header, Offset);
+        putU64(Header, D.Bitcode.size());
+        Offset = alignBlob(Offset + D.Bitcode.size());
+        putU64(Header, D.Object.empty() ? 0 : Offset);
+        putU64(Header, D.Object.size());
+        Offset = alignBlob(Offset + D.Object.size());
+    }
+    Header.resize(alignBlob(Header.size()), 0);
+
+    error_code EC;
+    raw_fd_ostream OS(OutPath, EC);
+    if (EC)
+    {
+        fprintf(stderr, "Error: could not write %s: %s\n", OutPath.c_str(), EC.message().c_str());
+        return false;
+    }
+    OS << Header;
+    for (auto &D : Defs)
+    {
+        OS.write(D.Bitcode.data(), D.Bitcode.size());
+        OS.write_zeros(alignBlob(D.Bitcode.size()) - D.Bitcode.size());
+        OS.write(D.Object.data(), D.Object.size());
+        OS.write_zeros(alignBlob(D.Object.size()) - D.Object.size());
+    }
+    return !OS.has_error();
+}
+
+bool CompileModuleFile(const string &SrcPath, const string &OutPath, bool WithObjects)
+{
+    auto Src = MemoryBuffer::getFile(SrcPath);
+    if (!Src)
+    {
+        fprintf(stderr, "Error: could not read %s\n", SrcPath.c_str());
+        return false;
+    }
+
+    vector<string> Imports;
+    vector<string> ProtoNames; // in the order they showed up
+    set<string> Seen;
+    vector<GrkcDef> Defs;
+    auto addProto = [&](const string &Name)
+    {
+        if (Seen.insert(Name).second)
+            ProtoNames.push_back(Name);
+    };
+
+    SourceHandlers H;
+    H.Def = [&](unique_ptr<FunctionAST> FnAST, const string &)
+    {
+        Function *FnIR = FnAST->codegen();
+        if (!FnIR)
+            return false;
+
+        GrkcDef D;
+        D.Name = FnIR->getName().str();
+        raw_svector_ostream BC(D.Bitcode);
+        WriteBitcodeToFile(*TheModule, BC);
+        bool Emitted = true;
+        if (WithObjects)
+        {
+            FnIR->setName(D.Name + ".grkc");
+            Emitted = emitObject(*TheModule, D.Object);
+        }
+        addProto(D.Name);
+        Defs.push_back(std::move(D));
+        InitializeModuleAndManagers();
+        return Emitted;
+    };
+    H.Extern = [&](unique_ptr<PrototypeAST> ProtoAST)
+    {
+        addProto(ProtoAST->getName());
+        FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+        return true;
+    };
+    H.Import = [&](const string &Name)
+    {
+        // the imported library's protos are needed to compile calls into it
+        string Resolved = ResolveImport(Name);
+        if (Resolved.empty() || !ImportLibrary(Resolved))
+            return false;
+        Imports.push_back(Resolved);
+        return true;
+    };
+    H.Expr = [](unique_ptr<FunctionAST>, const string &, const string &)
+    {
+        fprintf(stderr, "Warning: top-level expressions aren't saved in a module\n");
+        return true;
+    };
+
+    string Text = (*Src)->getBuffer().str();
+    if (!ParseSource(Text, H))
+    {
+        fprintf(stderr, "Error: %s has errors, no module written\n", SrcPath.c_str());
+        return false;
+    }
+    if (!writeModuleFile(OutPath, Imports, ProtoNames, Defs))
+        return false;
+    fprintf(stderr, "Wrote %zu definitions to %s\n", Defs.size(), OutPath.c_str());
+    return true;
+}
+
+bool LoadModuleFile(const string &Path, bool AsLibrary)
+{
+    PhaseTimer T(PHASE_JIT);
+
+    // big files get mmap'd rather than read
+    auto File = MemoryBuffer::getFile(Path, /*IsText*/ false, /*RequiresNullTerminator*/ false);
+    if (!File)
+    {
+        fprintf(stderr, "Error: could not read %s\n", Path.c_str());
+        return false;
+    }
+
+    GrkcReader R{(*File)->getBuffer()};
+    auto bad = [&]()
+    {
+        fprintf(stderr, "Error: %s is not a grok module\n", Path.c_str());
+        return false;
+    };
+
+    if (!R.Buf.starts_with(GRKC_MAGIC))
+        return bad();
+    R.Pos = strlen(GRKC_MAGIC);
+    if (R.num<uint32_t>() != GRKC_VERSION)
+    {
+        fprintf(stderr, "Error: %s was written by a different version of grok\n", Path.c_str());
+        return false;
+    }
+
+    StringRef Triple = R.str(), CPU = R.str(), Features = R.str();
+    if (Triple != TheJIT->getTargetMachine()->getTargetTriple().str())
+    {
+        fprintf(stderr, "Error: %s was compiled for %s\n", Path.c_str(), Triple.str().c_str());
+        return false;
+    }
+    bool UseObjects = CPU == TheJIT->getTargetCPU() && Features == TheJIT->getTargetFeatures();
+
+    vector<string> Imports(R.count(4));
+    for (auto &Import : Imports)
+        Import = R.str().str();
+
+    vector<unique_ptr<PrototypeAST>> Protos(R.count(4 + 1 + 4)); // name, flags, arg count
+    for (auto &P : Protos)
+    {
+        string Name = R.str().str();
+        uint8_t Flags = R.num<uint8_t>();
+        vector<string> Args(R.count(4));
+        for (auto &Arg : Args)
+            Arg = R.str().str();
+        P = make_unique<PrototypeAST>(Name, std::move(Args));
+        if (Flags & GRKC_EXTERN)
+            P->setExtern();
+        if (Flags & GRKC_GENERATOR)
+            P->setGenerator();
+    }
+
+    struct Blobs
+    {
+        string Name;
+        StringRef Bitcode, Object;
+    };
+    vector<Blobs> Defs(R.count(4 + 4 * 8)); // name, blob ranges
+    vector<uint64_t> Ranges;
+    for (auto &D : Defs)
+    {
+        D.Name = R.str().str();
+        for (int i = 0; i < 4; i++)
+            Ranges.push_back(R.num<uint64_t>());
+    }
+    if (!R.Ok)
+        return bad();
+
+    size_t DataStart = alignBlob(R.Pos);
+    for (size_t i = 0; i < Defs.size(); i++)
+    {
+        uint64_t *BC = &Ranges[4 * i], *Obj = BC + 2;
+        if (DataStart + BC[0] + BC[1] > R.Buf.size() || DataStart + Obj[0] + Obj[1] > R.Buf.size())
+            return bad();
+        Defs[i].Bitcode = R.Buf.substr(DataStart + BC[0], BC[1]);
+        Defs[i].Object = R.Buf.substr(DataStart + Obj[0], Obj[1]);
+    }
+
+    // a name with more than one def keeps the last (older files could have those)
+    set<string> Seen;
+    for (size_t i = Defs.size(); i-- > 0;)
+        if (!Seen.insert(Defs[i].Name).second)
+            Defs.erase(Defs.begin() + i);
+
+    for (auto &Import : Imports)
+        if (!ImportLibrary(Import))
+            return false;
+
+    // prototypes first, the defs' code calls through them
+    ProtoUndo Undo; // a library that fails to load takes its protos back out
+    for (auto &P : Protos)
+    {
+        if (IsHostFunction(P->getName()))
+            continue;
+        string Name = P->getName();
+        Undo.save(Name); // also drops its generator body, older than what's loaded
+        FunctionProtos[Name] = std::move(P);
+    }
+
+    JITDylib *Lib = AsLibrary ? &TheJIT->createLibraryJITDylib(Path) : nullptr;
+
+    // the object's symbol is fixed, in the main JITDylib it can only go in while nothing holds it
+    size_t Recompiled = 0;
+    auto addDef = [&](Blobs &D) -> Error
+    {
+        if (Lib && UseObjects && !D.Object.empty())
+            return TheJIT->addLibraryObject(*Lib, D.Name, D.Name + ".grkc",
+                                            MemoryBuffer::getMemBuffer(D.Object, Path, false));
+        if (!Lib && UseObjects && !D.Object.empty() && !TheJIT->hasDefinition(D.Name))
+            return TheJIT->addDefinitionObject(D.Name, D.Name + ".grkc",
+                                               MemoryBuffer::getMemBuffer(D.Object, Path, false));
+
+        Recompiled++;
+        auto Ctx = make_unique<LLVMContext>();
+        auto M = parseBitcodeFile(MemoryBufferRef(D.Bitcode, Path), *Ctx);
+        if (!M)
+            return M.takeError();
+        if (Lib)
+            return TheJIT->addLibraryModule(*Lib, ThreadSafeModule(std::move(*M), std::move(Ctx)));
+        return TheJIT->addDefinition(D.Name, ThreadSafeModule(std::move(*M), std::move(Ctx)));
+    };
+
+    for (auto &D : Defs)
+    {
+        if (auto Err = addDef(D))
+        {
+            logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+            // a library comes out again, so it can be imported once it's fixed
+            // (defs already in the main JITDylib are there to stay, and so are their protos)
+            if (Lib)
+            {
+                if (auto RemoveErr = TheJIT->removeLibraryJITDylib(*Lib))
+                    logAllUnhandledErrors(std::move(RemoveErr), errs(), "Error: ");
+                Undo.restore();
+            }
+            return false;
+        }
+    }
+
+    LoadedFiles.push_back(std::move(*File));
+    fprintf(stderr, "Loaded %zu definitions from %s (%zu compiled from bitcode)\n",
+            Defs.size(), Path.c_str(), Recompiled);
+    return true;
+}
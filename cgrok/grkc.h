@@ -0,0 +1,41 @@
+#ifndef GRKC_H
+#define GRKC_H
+
+#include <string>
+
+using namespace std;
+
+/*
+----PURPOSE:
+    Precompiled modules (.grkc). A .grkc holds what compiling a .grk library produced:
+    the prototypes it declares/defines (what FunctionProtos would hold), the optimized
+    bitcode of every def and, optionally, the def's native object code.
+    Loading one memory maps the file and hands the object code straight to the JIT linker,
+    so there's no lexing, parsing, codegen or optimizing. Object code is only used when the
+    file was built for the same target CPU and features as the running JIT, otherwise the
+    bitcode is compiled instead.
+    Top-level expressions aren't saved, a .grkc is a library. Its imports are recorded and
+    imported again when it's loaded.
+    Generators are saved compiled like any def, but not their bodies. For loops over a generator
+    loaded from a .grkc call its code instead of inlining a copy of it.
+*/
+
+#define GRKC_MAGIC "GRKC"
+#define GRKC_VERSION 3
+
+// prototype flags
+#define GRKC_EXTERN 1
+#define GRKC_GENERATOR 2
+
+// compile the defs and externs of the source file SrcPath into a module file at OutPath
+// without WithObjects only bitcode is saved (portable to any CPU of the same target)
+// returns false (and logs to stderr) on any error
+bool CompileModuleFile(const string &SrcPath, const string &OutPath, bool WithObjects = true);
+
+// add everything in the module file at Path to the JIT, replacing earlier definitions
+// AsLibrary loads it into a library JITDylib of its own instead (see import.h), where
+// defs are only linked once something refers to them
+// returns false (and logs to stderr) if it isn't a usable module file
+bool LoadModuleFile(const string &Path, bool AsLibrary = false);
+
+#endif
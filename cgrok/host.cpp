@@ -0,0 +1,166 @@
+#include "host.h"
+#include "codegen.h"
+#include "runtime.h"
+#include "input.h"
+
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <map>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// HOST FUNCTIONS ===============================================================================
+// ----------------------------------------------------------------------------------------------
+
+struct HostFunction
+{
+    unsigned NumArgs;
+    void *Addr;
+    string IRBody; // empty = call only
+};
+
+static map<string, HostFunction> HostFunctions;
+
+// parse Src into M, logging any error against Name
+static bool parseBodyInto(const string &Name, const string &Src, Module &M)
+{
+    SMDiagnostic Err;
+    if (parseAssemblyInto(MemoryBufferRef(Src, Name), &M, nullptr, Err))
+    {
+        Err.print(Name.c_str(), errs());
+        return false;
+    }
+    return true;
+}
+
+// the body has to define exactly @Name as double(double x NumArgs)
+static bool checkBody(const string &Name, unsigned NumArgs, const string &Src)
+{
+    LLVMContext Ctx;
+    Module M(Name, Ctx);
+    if (!parseBodyInto(Name, Src, M))
+        return false;
+
+    Function *F = M.getFunction(Name);
+    if (!F || F->isDeclaration())
+    {
+        fprintf(stderr, "Error: IR body for host function %s doesn't define @%s\n", Name.c_str(), Name.c_str());
+        return false;
+    }
+    bool SigOk = F->getReturnType()->isDoubleTy() && F->arg_size() == NumArgs;
+    for (auto &Arg : F->args())
+        SigOk = SigOk && Arg.getType()->isDoubleTy();
+    if (!SigOk)
+    {
+        fprintf(stderr, "Error: IR body for host function %s has the wrong signature\n", Name.c_str());
+        return false;
+    }
+    if (verifyModule(M, &errs()))
+        return false;
+    return true;
+}
+
+bool RegisterHostFunction(const string &Name, unsigned NumArgs, void *Addr, const string &IRBody)
+{
+    if (!IRBody.empty() && !checkBody(Name, NumArgs, IRBody))
+        return false;
+
+    if (auto Err = TheJIT->addHostFunction(Name, Addr))
+    {
+        logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+        return false;
+    }
+
+    HostFunctions[Name] = {NumArgs, Addr, IRBody};
+
+    // callable without an extern
+    vector<string> Args;
+    for (unsigned i = 0; i < NumArgs; i++)
+        Args.push_back("x" + to_string(i));
+    FunctionProtos[Name] = make_unique<PrototypeAST>(Name, std::move(Args));
+    return true;
+}
+
+bool IsHostFunction(const string &Name)
+{
+    return HostFunctions.count(Name) != 0;
+}
+
+Function *EmitHostFunctionBody(const string &Name)
+{
+    auto It = HostFunctions.find(Name);
+    if (It == HostFunctions.end() || It->second.IRBody.empty())
+        return nullptr;
+
+    // already checked when it was registered
+    if (!parseBodyInto(Name, It->second.IRBody, *TheModule))
+        return nullptr;
+
+    // only there to be inlined - if a call is left over, it goes to the host pointer
+    Function *F = TheModule->getFunction(Name);
+    F->setLinkage(GlobalValue::AvailableExternallyLinkage);
+    F->addFnAttr(Attribute::AlwaysInline);
+    return F;
+}
+
+void InlineHostCalls(Function &F)
+{
+    // collect first, inlining changes the instruction list
+    vector<CallBase *> Calls;
+    for (auto &BB : F)
+        for (auto &I : BB)
+            if (auto *CB = dyn_cast<CallBase>(&I))
+                if (auto *Callee = CB->getCalledFunction())
+                    if (!Callee->isDeclaration() && IsHostFunction(string(Callee->getName())))
+                        Calls.push_back(CB);
+
+    for (auto *CB : Calls)
+    {
+        InlineFunctionInfo IFI;
+        InlineFunction(*CB, IFI);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------
+// BUILTINS =====================================================================================
+// ----------------------------------------------------------------------------------------------
+
+void InstallHostBuiltins()
+{
+    RegisterHostFunction("putchard", 1, (void *)putchard);
+    RegisterHostFunction("printd", 1, (void *)printd);
+    RegisterHostFunction("flushd", 1, (void *)flushd);
+    RegisterHostFunction("sinkd", 1, (void *)sinkd); // never inlined, that's the point
+
+    // reading data files opened with --input (see input.h)
+    RegisterHostFunction("readd", 1, (void *)readd);
+    RegisterHostFunction("fieldd", 1, (void *)fieldd);
+    RegisterHostFunction("nextlined", 1, (void *)nextlined);
+    RegisterHostFunction("eofd", 1, (void *)eofd);
+    RegisterHostFunction("rewindd", 1, (void *)rewindd);
+
+    // small math helpers, inlined into grok code
+    RegisterHostFunction("mind", 2, (void *)mind,
+                         "define double @mind(double %a, double %b) {\n"
+                         "  %c = fcmp olt double %a, %b\n"
+                         "  %r = select i1 %c, double %a, double %b\n"
+                         "  ret double %r\n"
+                         "}\n");
+    RegisterHostFunction("maxd", 2, (void *)maxd,
+                         "define double @maxd(double %a, double %b) {\n"
+                         "  %c = fcmp ogt double %a, %b\n"
+                         "  %r = select i1 %c, double %a, double %b\n"
+                         "  ret double %r\n"
+                         "}\n");
+    RegisterHostFunction("absd", 1, (void *)absd,
+                         "define double @absd(double %x) {\n"
+                         "  %c = fcmp olt double %x, 0.0\n"
+                         "  %n = fneg double %x\n"
+                         "  %r = select i1 %c, double %n, double %x\n"
+                         "  ret double %r\n"
+                         "}\n");
+}
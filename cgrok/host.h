@@ -0,0 +1,38 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include "llvm/IR/Function.h"
+
+#include <string>
+
+using namespace std;
+
+/*
+----PURPOSE:
+    Host functions: double(double...) functions of the host program, registered by pointer
+    into the JIT instead of being found through the process symbol table (EXPORT + --export-dynamic).
+    They can be called from grok without an `extern` declaration.
+    A host function can also carry an LLVM IR body. Grok code that calls it then gets the body
+    inlined instead of a call, which is what small helpers used in inner loops want.
+    The pointer is still used wherever the body isn't inlined.
+*/
+
+// register Name as a host function taking NumArgs doubles, implemented at Addr.
+// IRBody, if given, is a textual IR definition of @Name with the same signature, ie.
+//   define double @mind(double %a, double %b) { ... }
+// returns false (and logs to stderr) if the body doesn't parse or doesn't match
+bool RegisterHostFunction(const string &Name, unsigned NumArgs, void *Addr, const string &IRBody = "");
+
+bool IsHostFunction(const string &Name);
+
+// put Name's IR body into TheModule so calls to it can be inlined
+// returns nullptr if Name has no body (caller should fall back to a declaration)
+llvm::Function *EmitHostFunctionBody(const string &Name);
+
+// inline every call in F to a host function whose body is in the module
+void InlineHostCalls(llvm::Function &F);
+
+// register the runtime builtins that come with grok (see runtime.cpp)
+void InstallHostBuiltins();
+
+#endif
@@ -0,0 +1,182 @@
+#include "import.h"
+#include "codegen.h"
+#include "parser.h"
+#include "lexer.h"
+#include "toplevel.h"
+#include "grkc.h"
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// IMPORTS ======================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// canonical paths of everything imported (or being imported)
+static set<string> Imported;
+
+// directories of the libraries being compiled, innermost last
+static vector<filesystem::path> ImportDirs;
+
+string ResolveImport(const string &Name)
+{
+    if (Name.empty())
+        return "";
+
+    filesystem::path P(Name);
+    if (!P.has_extension())
+        P += ".grk";
+    filesystem::path Pre = P;
+    Pre.replace_extension(".grkc");
+
+    vector<filesystem::path> Candidates;
+    if (P.is_relative() && !ImportDirs.empty())
+        Candidates.push_back(ImportDirs.back() / P);
+    Candidates.push_back(P);
+
+    error_code EC;
+    for (auto &C : Candidates)
+    {
+        filesystem::path CPre = C;
+        CPre.replace_extension(".grkc");
+        if (filesystem::exists(C, EC))
+            return filesystem::weakly_canonical(C, EC).string();
+        if (filesystem::exists(CPre, EC))
+            return filesystem::weakly_canonical(CPre, EC).string();
+    }
+
+    fprintf(stderr, "Error: can't find %s to import\n", Name.c_str());
+    return "";
+}
+
+// parse, codegen and optimize every def/extern in the source file Path, then hand the
+// defs' IR to a library JITDylib, which only compiles them to native code when looked up
+static bool compileLibrary(const string &Path)
+{
+    ifstream In(Path, ios::binary);
+    if (!In)
+    {
+        fprintf(stderr, "Error: could not read %s\n", Path.c_str());
+        return false;
+    }
+    stringstream SS;
+    SS << In.rdbuf();
+    string Src = SS.str();
+
+    // each def's module, by name. a name defined twice keeps its last def, the same as
+    // typing the library in would
+    struct LibraryDef
+    {
+        size_t NumArgs;
+        bool Generator;
+        ThreadSafeModule TSM;
+    };
+    map<string, LibraryDef> Defs;
+    ProtoUndo Undo; // the library's protos only stay if it's imported
+
+    SourceHandlers H;
+    H.Def = [&](unique_ptr<FunctionAST> FnAST, const string &)
+    {
+        string Name = FnAST->getProto().getName();
+        size_t NumArgs = FnAST->getProto().getNumArgs();
+        bool Generator = FnAST->getProto().isGenerator();
+        // earlier defs in the library were compiled to call the first one
+        auto Prev = Defs.find(Name);
+        if (Prev != Defs.end() && (Prev->second.NumArgs != NumArgs || Prev->second.Generator != Generator))
+        {
+            fprintf(stderr, "Error: %s is defined twice with different parameters\n", Name.c_str());
+            return false;
+        }
+        Undo.save(Name);
+        if (!FnAST->codegen())
+            return false;
+        Defs[Name] = {NumArgs, Generator, ThreadSafeModule(std::move(TheModule), std::move(TheContext))};
+        InitializeModuleAndManagers();
+        return true;
+    };
+    H.Extern = [&](unique_ptr<PrototypeAST> ProtoAST)
+    {
+        Undo.save(ProtoAST->getName());
+        FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+        return true;
+    };
+    H.Import = [](const string &Name) { return ImportLibrary(Name); };
+    // libraries don't run anything
+    H.Expr = [](unique_ptr<FunctionAST>, const string &, const string &) { return true; };
+
+    ImportDirs.push_back(filesystem::path(Path).parent_path());
+    bool Ok = ParseSource(Src, H);
+    ImportDirs.pop_back();
+
+    // the library can only be created now, after anything it imports
+    if (Ok)
+    {
+        auto &Lib = TheJIT->createLibraryJITDylib(Path);
+        for (auto &[Name, D] : Defs)
+        {
+            if (auto Err = TheJIT->addLibraryModule(Lib, std::move(D.TSM)))
+            {
+                logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+                // nothing's been linked against it yet, and a retry creates it again
+                if (auto RemoveErr = TheJIT->removeLibraryJITDylib(Lib))
+                    logAllUnhandledErrors(std::move(RemoveErr), errs(), "Error: ");
+                Ok = false;
+                break;
+            }
+        }
+    }
+
+    if (!Ok)
+    {
+        Undo.restore();
+        fprintf(stderr, "Error: %s has errors, not imported\n", Path.c_str());
+        return false;
+    }
+
+    fprintf(stderr, "Imported %zu definitions from %s\n", Defs.size(), Path.c_str());
+    return true;
+}
+
+bool ImportLibrary(const string &Name)
+{
+    string Path = ResolveImport(Name);
+    if (Path.empty())
+        return false;
+    if (!Imported.insert(Path).second)
+        return true;
+
+    bool Ok;
+    filesystem::path Src(Path), Pre(Path);
+    Pre.replace_extension(".grkc");
+    error_code EC;
+    if (Src == Pre)
+        Ok = LoadModuleFile(Path, /*AsLibrary*/ true);
+    else if (filesystem::exists(Pre, EC) &&
+             (!filesystem::exists(Src, EC) || filesystem::last_write_time(Pre, EC) >= filesystem::last_write_time(Src, EC)))
+        Ok = LoadModuleFile(Pre.string(), /*AsLibrary*/ true);
+    else
+        Ok = compileLibrary(Path);
+
+    // let it be tried again once it's fixed
+    if (!Ok)
+        Imported.erase(Path);
+    return Ok;
+}
+
+void HandleImport()
+{
+    string Name = ParseImport();
+    if (Name.empty())
+    {
+        // error recovery
+        getNextToken();
+        return;
+    }
+    ImportLibrary(Name);
+}
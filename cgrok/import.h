@@ -0,0 +1,34 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <string>
+
+using namespace std;
+
+/*
+----PURPOSE:
+    Imports: `import "lib"` compiles another grok file once, as a library in a JITDylib of
+    its own. Its defs and externs can then be called like any other. Importing a source
+    file still generates and optimizes IR for every def, only the native code generation
+    (or linking, from a .grkc) waits until code that runs refers to the def. So a big
+    utility library costs parse + IR time up front but no instruction selection; importing
+    its precompiled .grkc skips all of that.
+    Importing a file that was already imported does nothing. Top-level expressions in a
+    library are ignored, and a def outside the library with the same name as one inside it
+    takes over everywhere but in the library itself.
+*/
+
+// find the file an import refers to: "lib" means lib.grk, or lib.grkc if that's all there is.
+// relative names are looked up next to the library doing the import, then in the current directory.
+// returns its canonical path, "" (after logging) if there's no such file
+string ResolveImport(const string &Name);
+
+// import Name (anything ResolveImport takes). a precompiled lib.grkc that's not older than
+// lib.grk is loaded instead of compiling the source
+// returns false (and logs to stderr) if it couldn't be imported
+bool ImportLibrary(const string &Name);
+
+// import ::= 'import' string, at the top level
+void HandleImport();
+
+#endif
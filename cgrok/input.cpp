@@ -0,0 +1,230 @@
+#include "input.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+
+// ----------------------------------------------------------------------------------------------
+// INPUT FILES ==================================================================================
+// ----------------------------------------------------------------------------------------------
+
+struct InputFile
+{
+    unique_ptr<MemoryBuffer> Buf; // ends in a 0 byte, which stops every scan below
+    const char *Cur, *End;        // read position
+
+    // where the next number after PeekFrom is, so eofd() followed by readd() only scans once
+    const char *PeekFrom = nullptr;
+    const char *Peeked = nullptr;
+};
+
+static vector<unique_ptr<InputFile>> Inputs;
+
+int OpenInput(const string &Path)
+{
+    // mapped if the file is big enough for that to pay off
+    auto Buf = MemoryBuffer::getFile(Path, /*IsText*/ false, /*RequiresNullTerminator*/ true);
+    if (!Buf)
+    {
+        fprintf(stderr, "Error: could not open input %s: %s\n", Path.c_str(), Buf.getError().message().c_str());
+        return -1;
+    }
+
+    auto F = make_unique<InputFile>();
+    F->Cur = (*Buf)->getBufferStart();
+    F->End = (*Buf)->getBufferEnd();
+    F->Buf = std::move(*Buf);
+    Inputs.push_back(std::move(F));
+    return Inputs.size() - 1;
+}
+
+// nullptr for anything that isn't an open input's number (NaN included)
+static InputFile *getInput(double In)
+{
+    if (!(In >= 0 && In < Inputs.size()))
+        return nullptr;
+    return Inputs[(size_t)In].get();
+}
+
+// ----------------------------------------------------------------------------------------------
+// NUMBER PARSING ===============================================================================
+// ----------------------------------------------------------------------------------------------
+
+static inline bool isDigit(char C)
+{
+    return (unsigned char)(C - '0') < 10;
+}
+
+// a digit, or a sign and/or '.' followed by one
+static inline bool startsNumber(const char *P)
+{
+    if (isDigit(*P))
+        return true;
+    if (*P == '+' || *P == '-')
+        P++;
+    if (*P == '.')
+        P++;
+    return isDigit(*P);
+}
+
+// first number at or after P, End if there isn't one
+// StopAtNewline gives up at the end of the line instead (returns the '\n')
+static const char *skipToNumber(const char *P, const char *End, bool StopAtNewline)
+{
+    for (; P < End; P++)
+    {
+        if (startsNumber(P))
+            return P;
+        if (StopAtNewline && *P == '\n')
+            return P;
+    }
+    return End;
+}
+
+// powers of ten a double holds exactly
+static const double Pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// parse the number starting at P into V, returns where it ends
+// up to 15 significant digits times a power of ten up to 1e22 (nearly everything in a data file)
+// is one multiply or divide of two exact doubles, which rounds correctly. the rest goes to strtod
+static const char *parseNumber(const char *P, double &V)
+{
+    const char *Start = P;
+    bool Neg = *P == '-';
+    if (*P == '+' || *P == '-')
+        P++;
+
+    uint64_t Mant = 0;
+    int Digits = 0; // significant digits seen
+    int Exp = 0;    // V = Mant * 10^Exp
+    auto digit = [&](char C, int Scale)
+    {
+        if (Mant != 0 || C != '0')
+            Digits++;
+        if (Digits <= 19) // past that only strtod can do it anyway
+        {
+            Mant = Mant * 10 + (C - '0');
+            Exp += Scale;
+        }
+    };
+
+    for (; isDigit(*P); P++)
+        digit(*P, 0);
+    if (*P == '.')
+        for (P++; isDigit(*P); P++)
+            digit(*P, -1);
+
+    // an e that isn't followed by an exponent isn't part of the number
+    if (*P == 'e' || *P == 'E')
+    {
+        const char *E = P + 1;
+        bool ExpNeg = *E == '-';
+        if (*E == '+' || *E == '-')
+            E++;
+        if (isDigit(*E))
+        {
+            int X = 0;
+            for (; isDigit(*E); E++)
+                if (X < 100000)
+                    X = X * 10 + (*E - '0');
+            Exp += ExpNeg ? -X : X;
+            P = E;
+        }
+    }
+
+    if (Digits <= 15 && Exp >= -22 && Exp <= 22)
+    {
+        V = Exp < 0 ? (double)Mant / Pow10[-Exp] : (double)Mant * Pow10[Exp];
+        if (Neg)
+            V = -V;
+    }
+    else
+        V = strtod(Start, nullptr); // stops where we did
+    return P;
+}
+
+// the next number after the read position (without moving it)
+static const char *nextNumber(InputFile &F)
+{
+    if (F.PeekFrom != F.Cur)
+    {
+        F.PeekFrom = F.Cur;
+        F.Peeked = skipToNumber(F.Cur, F.End, false);
+    }
+    return F.Peeked;
+}
+
+// ----------------------------------------------------------------------------------------------
+// == INPUT BUILTINS ============================================================================
+// ----------------------------------------------------------------------------------------------
+
+// readd - next number in the input, wherever it is. NaN at the end of the input
+extern "C" double readd(double In)
+{
+    InputFile *F = getInput(In);
+    if (!F)
+        return NAN;
+
+    const char *P = nextNumber(*F);
+    if (P == F->End)
+    {
+        F->Cur = P;
+        return NAN;
+    }
+    double V;
+    F->Cur = parseNumber(P, V);
+    return V;
+}
+
+// fieldd - next number on the current line. NaN if it has no more, without leaving the line
+extern "C" double fieldd(double In)
+{
+    InputFile *F = getInput(In);
+    if (!F)
+        return NAN;
+
+    F->Cur = skipToNumber(F->Cur, F->End, true);
+    if (F->Cur == F->End || *F->Cur == '\n')
+        return NAN;
+    double V;
+    F->Cur = parseNumber(F->Cur, V);
+    return V;
+}
+
+// nextlined - skip the rest of the current line. returns 1, or 0 if that was the last line
+extern "C" double nextlined(double In)
+{
+    InputFile *F = getInput(In);
+    if (!F)
+        return 0;
+
+    auto *NL = (const char *)memchr(F->Cur, '\n', F->End - F->Cur);
+    F->Cur = NL ? NL + 1 : F->End;
+    return F->Cur < F->End ? 1 : 0;
+}
+
+// eofd - 1 once readd() has nothing left to return
+extern "C" double eofd(double In)
+{
+    InputFile *F = getInput(In);
+    if (!F)
+        return 1;
+    return nextNumber(*F) == F->End ? 1 : 0;
+}
+
+// rewindd - start reading the input from the top again, returns 0
+extern "C" double rewindd(double In)
+{
+    if (InputFile *F = getInput(In))
+        F->Cur = F->Buf->getBufferStart();
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <string>
+
+using namespace std;
+
+/*
+----PURPOSE:
+    Input layer used by the input builtins (readd, fieldd, nextlined, ...).
+    Data files are opened by the host (--input on the command line, or OpenInput() when
+    embedding) and get numbered 0, 1, 2... in the order they were opened; grok code passes
+    that number to the builtins. A file is memory mapped where possible (read in one go
+    otherwise) and numbers are parsed straight out of the mapping, so nothing is copied.
+    Anything that isn't part of a number separates numbers, ie. spaces, commas, tabs, or
+    words in a header line. Lines are records: fieldd() stays on the current line,
+    nextlined() moves to the next one.
+    An input has one read position shared by everyone, only use it from one thread at a time.
+*/
+
+// open the data file at Path, returns its input number or -1 (after logging) if it can't be read
+int OpenInput(const string &Path);
+
+// builtins callable from grok code, registered with the JIT by InstallHostBuiltins()
+// In is an input number, a bad one reads as an empty input
+extern "C" double readd(double In);     // next number, NaN at the end of the input
+extern "C" double fieldd(double In);    // next number on the current line, NaN if there are none left
+extern "C" double nextlined(double In); // skip to the next line, 0 if there isn't one (else 1)
+extern "C" double eofd(double In);      // 1 if there are no numbers left, else 0
+extern "C" double rewindd(double In);   // back to the start, returns 0
+
+#endif
@@ -0,0 +1,166 @@
+#include "interp.h"
+#include "ast.h"
+#include "codegen.h"
+#include "lexer.h"
+
+#include <cmath>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// INTERPRETER ==================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// semantics have to match codegen.cpp exactly, the same expression may be
+// interpreted once and JIT compiled the next time
+
+double CallNative(void *Addr, const double *A, unsigned NumArgs)
+{
+    typedef double D;
+    switch (NumArgs)
+    {
+    case 0:
+        return ((D(*)())Addr)();
+    case 1:
+        return ((D(*)(D))Addr)(A[0]);
+    case 2:
+        return ((D(*)(D, D))Addr)(A[0], A[1]);
+    case 3:
+        return ((D(*)(D, D, D))Addr)(A[0], A[1], A[2]);
+    case 4:
+        return ((D(*)(D, D, D, D))Addr)(A[0], A[1], A[2], A[3]);
+    case 5:
+        return ((D(*)(D, D, D, D, D))Addr)(A[0], A[1], A[2], A[3], A[4]);
+    case 6:
+        return ((D(*)(D, D, D, D, D, D))Addr)(A[0], A[1], A[2], A[3], A[4], A[5]);
+    case 7:
+        return ((D(*)(D, D, D, D, D, D, D))Addr)(A[0], A[1], A[2], A[3], A[4], A[5], A[6]);
+    default: // MAX_NATIVE_ARGS
+        return ((D(*)(D, D, D, D, D, D, D, D))Addr)(A[0], A[1], A[2], A[3], A[4], A[5], A[6], A[7]);
+    }
+}
+
+bool NumberExprAST::canInterpret()
+{
+    return true;
+}
+
+double NumberExprAST::interpret()
+{
+    return Val;
+}
+
+bool BinaryExprAST::canInterpret()
+{
+    switch (Op)
+    {
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+    case '%':
+    case '<':
+    case '>':
+    case tok_le:
+    case tok_ge:
+    case tok_eq:
+    case tok_ne:
+    case tok_and:
+    case tok_or:
+        return LHS->canInterpret() && RHS->canInterpret();
+    default:
+        return false; // let codegen report it
+    }
+}
+
+// ordered not-equal to 0.0, like FCmpONE (NaN is false)
+static bool isTrue(double V)
+{
+    return V < 0.0 || V > 0.0;
+}
+
+double BinaryExprAST::interpret()
+{
+    // the right side only runs if the left doesn't decide it, like codegen
+    if (Op == tok_and)
+        return isTrue(LHS->interpret()) && isTrue(RHS->interpret());
+    if (Op == tok_or)
+        return isTrue(LHS->interpret()) || isTrue(RHS->interpret());
+
+    double L = LHS->interpret();
+    double R = RHS->interpret();
+
+    switch (Op)
+    {
+    case '+':
+        return L + R;
+    case '-':
+        return L - R;
+    case '*':
+        return L * R;
+    case '/':
+        return L / R;
+    case '%':
+        return fmod(L, R); // same as frem
+    case '<':
+        return !(L >= R); // unordered less than, like FCmpULT
+    case '>':
+        return !(L <= R); // unordered greater than, like FCmpUGT
+    case tok_le:
+        return !(L > R);
+    case tok_ge:
+        return !(L < R);
+    case tok_eq:
+        return L == R; // ordered, like FCmpOEQ
+    default: // tok_ne
+        return L != R; // unordered, like FCmpUNE
+    }
+}
+
+bool CallExprAST::canInterpret()
+{
+    // need a prototype to check the arg count, same as codegen
+    auto FI = FunctionProtos.find(Callee);
+    if (FI == FunctionProtos.end() || FI->second->getNumArgs() != Args.size())
+        return false;
+    if (FI->second->isGenerator()) // returns a coroutine, codegen reports it
+        return false;
+    if (Args.size() > MAX_NATIVE_ARGS)
+        return false;
+
+    for (auto &Arg : Args)
+        if (!Arg->canInterpret())
+            return false;
+
+    // find the native code - a JIT'd def or a host function
+    auto Sym = TheJIT->lookup(Callee);
+    if (!Sym)
+    {
+        consumeError(Sym.takeError()); // codegen path will report it
+        return false;
+    }
+    CalleeAddr = Sym->getAddress().toPtr<void *>();
+    return true;
+}
+
+double CallExprAST::interpret()
+{
+    double ArgVals[MAX_NATIVE_ARGS];
+    for (unsigned i = 0, e = Args.size(); i != e; ++i)
+        ArgVals[i] = Args[i]->interpret();
+
+    return CallNative(CalleeAddr, ArgVals, Args.size());
+}
+
+bool IfExprAST::canInterpret()
+{
+    return Cond->canInterpret() && Then->canInterpret() && Else->canInterpret();
+}
+
+double IfExprAST::interpret()
+{
+    if (isTrue(Cond->interpret()))
+        return Then->interpret();
+    return Else->interpret();
+}
@@ -0,0 +1,18 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+/*
+----PURPOSE:
+    Interpreter tier. Evaluates simple expression ASTs directly (see canInterpret()/interpret()
+    in ast.h) so one-off top-level expressions like `1+2;` or `printd(fib(10));` don't pay
+    for IR generation, optimization and machine code emission.
+    Calls still go to native code: JIT'd defs and externs are looked up and called directly.
+*/
+
+// most args a native call through CallNative() can pass
+#define MAX_NATIVE_ARGS 8
+
+// call a double(double, ...) function at Addr with NumArgs doubles
+double CallNative(void *Addr, const double *Args, unsigned NumArgs);
+
+#endif
@@ -0,0 +1,94 @@
+#include "jitevents.h"
+#include "codegen.h"
+
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/DebugObjectManagerPlugin.h"
+#include "llvm/ExecutionEngine/Orc/EPCDebugObjectRegistrar.h"
+
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// JIT EVENT LISTENERS ==========================================================================
+// ----------------------------------------------------------------------------------------------
+
+static bool GDBEnabled = false;
+static bool PerfEnabled = false;
+
+void EnableGDBJITInterface() { GDBEnabled = true; }
+void EnablePerfSupport() { PerfEnabled = true; }
+
+// writes "<start> <size> <name>" for every JIT'd function to /tmp/perf-<pid>.map,
+// the format perf looks for when it can't resolve an address in an anonymous mapping
+class PerfMapPlugin : public ObjectLinkingLayer::Plugin
+{
+    FILE *Map = nullptr;
+    mutex Lock; // graphs can be linked from more than one thread (embedding API)
+
+public:
+    PerfMapPlugin()
+    {
+        char Path[64];
+        snprintf(Path, sizeof(Path), "/tmp/perf-%d.map", (int)getpid());
+        Map = fopen(Path, "w");
+        if (!Map)
+            fprintf(stderr, "Error: could not open %s\n", Path);
+    }
+    ~PerfMapPlugin() override
+    {
+        if (Map)
+            fclose(Map);
+    }
+
+    void modifyPassConfig(MaterializationResponsibility &MR, jitlink::LinkGraph &G,
+                          jitlink::PassConfiguration &Config) override
+    {
+        // symbols have their final addresses once fixups are applied
+        Config.PostFixupPasses.push_back([this](jitlink::LinkGraph &G) -> Error
+        {
+            writeSymbols(G);
+            return Error::success();
+        });
+    }
+
+    void writeSymbols(jitlink::LinkGraph &G)
+    {
+        if (!Map)
+            return;
+
+        lock_guard<mutex> Guard(Lock);
+        for (auto *Sym : G.defined_symbols())
+            if (Sym->isCallable() && Sym->hasName())
+                fprintf(Map, "%llx %llx %s\n", (unsigned long long)Sym->getAddress().getValue(),
+                        (unsigned long long)Sym->getSize(), Sym->getName().str().c_str());
+        // perf may read the map while we're still running
+        fflush(Map);
+    }
+
+    Error notifyFailed(MaterializationResponsibility &MR) override { return Error::success(); }
+    Error notifyRemovingResources(JITDylib &JD, ResourceKey K) override { return Error::success(); }
+    void notifyTransferringResources(JITDylib &JD, ResourceKey DstKey, ResourceKey SrcKey) override {}
+};
+
+void InstallJITEventListeners()
+{
+    auto &ObjLayer = TheJIT->getObjectLayer();
+    auto &ES = ObjLayer.getExecutionSession();
+
+    if (GDBEnabled)
+    {
+        // hands each linked object to __jit_debug_register_code in this process
+        // (needs --export-dynamic, like the runtime builtins)
+        if (auto Registrar = createJITLoaderGDBRegistrar(ES))
+            ObjLayer.addPlugin(make_unique<DebugObjectManagerPlugin>(ES, std::move(*Registrar)));
+        else
+            logAllUnhandledErrors(Registrar.takeError(), errs(), "Error: gdb JIT interface: ");
+    }
+
+    if (PerfEnabled)
+        ObjLayer.addPlugin(make_unique<PerfMapPlugin>());
+}
@@ -0,0 +1,19 @@
+#ifndef JITEVENTS_H
+#define JITEVENTS_H
+
+/*
+----PURPOSE:
+    Make JIT'd grok functions visible to debuggers and profilers.
+    --gdb   registers every loaded object with the GDB JIT interface, so gdb/lldb
+            can show grok functions by name in backtraces and set breakpoints on them
+    --perf  writes /tmp/perf-<pid>.map so `perf report` and flamegraphs name grok functions
+    Both have to be turned on before the JIT is created.
+*/
+
+void EnableGDBJITInterface();
+void EnablePerfSupport();
+
+// register the enabled listeners with TheJIT's object layer
+void InstallJITEventListeners();
+
+#endif
@@ -1,10 +1,27 @@
 #include "lexer.h"
 #include "codegen.h"
 
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <iostream>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LEXER_SSE2 1
+#endif
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define fileno _fileno
+#endif
+#ifndef S_ISREG
+#define S_ISREG(Mode) (((Mode) & S_IFMT) == S_IFREG)
+#endif
+
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Function.h>
 
@@ -18,18 +35,371 @@ std::string IdentifierStr; // used if tok_identifier
 double NumVal;             // used if tok_number
 std::string StrVal;        // used if tok_string
 
+static int LastChar = ' '; // previous char
+
+// in-memory source, only used when FromString is set
+static bool FromString = false;
+static const char *SrcCur = nullptr;
+static const char *SrcEnd = nullptr;
+
+// all of stdin, when it's a file/pipe rather than a terminal
+static std::string StdinBuf;
+
+unsigned LexerGeneration = 0;
+
+void SetLexerSource(const std::string &Src)
+{
+    LexerGeneration++;
+    FromString = true;
+    SrcCur = Src.data();
+    SrcEnd = Src.data() + Src.size();
+    LastChar = ' ';
+}
+
+void SetLexerStdin()
+{
+    LexerGeneration++;
+    FromString = false;
+    SrcCur = SrcEnd = nullptr;
+    LastChar = ' ';
+}
+
+LexerState SaveLexerState()
+{
+    return {FromString, SrcCur, SrcEnd, LastChar};
+}
+
+void RestoreLexerState(const LexerState &S)
+{
+    LexerGeneration++;
+    FromString = S.FromString;
+    SrcCur = S.SrcCur;
+    SrcEnd = S.SrcEnd;
+    LastChar = S.LastChar;
+}
+
+bool LoadLexerStdin()
+{
+    // a terminal or a pipe has to be read as the data arrives, each statement runs as soon as
+    // it's complete (a coprocess or `tail -f log | k` may never close its end)
+    struct stat St;
+    if (fstat(fileno(stdin), &St) != 0 || !S_ISREG(St.st_mode))
+        return false;
+
+    char Chunk[64 * 1024];
+    size_t N;
+    while ((N = fread(Chunk, 1, sizeof(Chunk), stdin)) > 0)
+        StdinBuf.append(Chunk, N);
+    SetLexerSource(StdinBuf);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------
+// KEYWORDS =====================================================================================
+// ----------------------------------------------------------------------------------------------
+
+struct Keyword
+{
+    const char *Name;
+    size_t Len;
+    int Tok;
+};
+
+static constexpr Keyword Keywords[] = {
+    {"def", 3, tok_def},
+    {"extern", 6, tok_extern},
+    {"if", 2, tok_if},
+    {"then", 4, tok_then},
+    {"else", 4, tok_else},
+    {"for", 3, tok_for},
+    {"in", 2, tok_in},
+    {"import", 6, tok_import},
+    {"yield", 5, tok_yield},
+};
+
+// perfect hash over the keywords above: first char + last char + 2 * length
+// (checked by the static_assert below - pick a new formula if a keyword is added and it fires)
+#define KEYWORD_SLOTS 16
+
+static constexpr unsigned keywordHash(char First, char Last, size_t Len)
+{
+    return ((unsigned char)First + (unsigned char)Last + 2 * Len) & (KEYWORD_SLOTS - 1);
+}
+
+struct KeywordTable
+{
+    Keyword Slots[KEYWORD_SLOTS];
+    bool Perfect;
+};
+
+static constexpr KeywordTable makeKeywordTable()
+{
+    KeywordTable T = {};
+    T.Perfect = true;
+    for (auto &K : Keywords)
+    {
+        auto &Slot = T.Slots[keywordHash(K.Name[0], K.Name[K.Len - 1], K.Len)];
+        if (Slot.Name)
+            T.Perfect = false;
+        Slot = K;
+    }
+    return T;
+}
+
+static constexpr KeywordTable KeywordSlots = makeKeywordTable();
+static_assert(KeywordSlots.Perfect, "keyword hash has a collision");
+
+// tok_identifier unless S is a keyword
+static int lookupKeyword(const char *S, size_t Len)
+{
+    if (Len < 2 || Len > 6)
+        return tok_identifier;
+    auto &Slot = KeywordSlots.Slots[keywordHash(S[0], S[Len - 1], Len)];
+    if (Slot.Len == Len && memcmp(Slot.Name, S, Len) == 0)
+        return Slot.Tok;
+    return tok_identifier;
+}
+
+// two char operators, a char that doesn't start one of these is a token by itself
+struct TwoCharOp
+{
+    char First, Second;
+    int Tok;
+};
+
+static constexpr TwoCharOp TwoCharOps[] = {
+    {'<', '=', tok_le},
+    {'>', '=', tok_ge},
+    {'=', '=', tok_eq},
+    {'!', '=', tok_ne},
+    {'&', '&', tok_and},
+    {'|', '|', tok_or},
+};
+
+// 0 unless First Second is an operator
+static int lookupTwoCharOp(int First, int Second)
+{
+    for (auto &Op : TwoCharOps)
+        if (First == Op.First && Second == Op.Second)
+            return Op.Tok;
+    return 0;
+}
+
+// ----------------------------------------------------------------------------------------------
+// BUFFER SCANNING ==============================================================================
+// ----------------------------------------------------------------------------------------------
+
+// character classes, same as isspace/isalnum/isdigit in the C locale
+enum CharClass : unsigned char
+{
+    CC_SPACE = 1,
+    CC_ALPHA = 2,
+    CC_DIGIT = 4,
+    CC_DOT = 8,
+};
+
+struct CharClassTable
+{
+    unsigned char Class[256];
+};
+
+static constexpr CharClassTable makeCharClassTable()
+{
+    CharClassTable T = {};
+    for (int C = 0; C < 256; C++)
+    {
+        if (C == ' ' || (C >= '\t' && C <= '\r'))
+            T.Class[C] |= CC_SPACE;
+        if ((C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z'))
+            T.Class[C] |= CC_ALPHA;
+        if (C >= '0' && C <= '9')
+            T.Class[C] |= CC_DIGIT;
+        if (C == '.')
+            T.Class[C] |= CC_DOT;
+    }
+    return T;
+}
+
+static constexpr CharClassTable CharClasses = makeCharClassTable();
+
+static inline bool inClass(char C, unsigned Mask)
+{
+    return CharClasses.Class[(unsigned char)C] & Mask;
+}
+
+#ifdef LEXER_SSE2
+// lanes of C in [Lo, Hi]. bytes >= 0x80 are negative, so never match an ASCII range
+static inline __m128i inRange(__m128i C, char Lo, char Hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(C, _mm_set1_epi8(Lo - 1)),
+                         _mm_cmplt_epi8(C, _mm_set1_epi8(Hi + 1)));
+}
+
+// lanes of C that are in every class of Mask's union
+static inline __m128i classMask(__m128i C, unsigned Mask)
+{
+    __m128i M = _mm_setzero_si128();
+    if (Mask & CC_SPACE)
+        M = _mm_or_si128(M, _mm_or_si128(_mm_cmpeq_epi8(C, _mm_set1_epi8(' ')), inRange(C, '\t', '\r')));
+    if (Mask & CC_ALPHA) // setting 0x20 folds upper case onto lower case
+        M = _mm_or_si128(M, inRange(_mm_or_si128(C, _mm_set1_epi8(0x20)), 'a', 'z'));
+    if (Mask & CC_DIGIT)
+        M = _mm_or_si128(M, inRange(C, '0', '9'));
+    if (Mask & CC_DOT)
+        M = _mm_or_si128(M, _mm_cmpeq_epi8(C, _mm_set1_epi8('.')));
+    return M;
+}
+#endif
+
+// first char at or after P that isn't in Mask's classes, 16 chars at a time where possible
+static const char *scanClass(const char *P, const char *End, unsigned Mask)
+{
+#ifdef LEXER_SSE2
+    while (End - P >= 16)
+    {
+        __m128i C = _mm_loadu_si128((const __m128i *)P);
+        unsigned Miss = ~(unsigned)_mm_movemask_epi8(classMask(C, Mask)) & 0xFFFF;
+        if (Miss)
+            return P + __builtin_ctz(Miss);
+        P += 16;
+    }
+#endif
+    while (P != End && inClass(*P, Mask))
+        P++;
+    return P;
+}
+
+// lex one token starting at P, leaving P just past it
+// identifier/string text is recorded as an offset from Base, numbers by value
+static void lexToken(const char *&P, const char *End, const char *Base, LexedToken &T)
+{
+    for (;;)
+    {
+        P = scanClass(P, End, CC_SPACE);
+        if (P == End || *P != '?')
+            break;
+        // comment lasts until end of line
+        while (P != End && *P != '\n' && *P != '\r')
+            P++;
+    }
+
+    T.Offset = P - Base;
+    T.Len = 0;
+    T.Num = 0;
+
+    if (P == End)
+    {
+        T.Kind = tok_eof;
+        return;
+    }
+
+    // identifier: [a-zA-Z][a-zA-Z0-9]*
+    if (inClass(*P, CC_ALPHA))
+    {
+        const char *Start = P;
+        P = scanClass(P + 1, End, CC_ALPHA | CC_DIGIT);
+        T.Len = P - Start;
+        T.Kind = lookupKeyword(Start, T.Len);
+        return;
+    }
+
+    // number: [0-9.]+
+    if (inClass(*P, CC_DIGIT | CC_DOT))
+    {
+        const char *Start = P;
+        P = scanClass(P + 1, End, CC_DIGIT | CC_DOT);
+        // like strtod, use the longest prefix that's a number (0 if there isn't one)
+        auto Res = from_chars(Start, P, T.Num);
+        if (Res.ec == errc::result_out_of_range)
+            T.Num = strtod(string(Start, Res.ptr).c_str(), nullptr); // overflow is inf, underflow 0 or a denormal
+        else if (Res.ec != errc())
+            T.Num = 0;
+        T.Kind = tok_number;
+        return;
+    }
+
+    // string: "..." (or until the input runs out)
+    if (*P == '"')
+    {
+        const char *Start = P + 1;
+        const char *Close = (const char *)memchr(Start, '"', End - Start);
+        if (!Close)
+            Close = End;
+        T.Offset = Start - Base;
+        T.Len = Close - Start;
+        T.Kind = tok_string;
+        P = Close == End ? End : Close + 1;
+        return;
+    }
+
+    if (End - P >= 2)
+    {
+        if (int Op = lookupTwoCharOp(P[0], P[1]))
+        {
+            T.Kind = Op;
+            P += 2;
+            return;
+        }
+    }
+
+    T.Kind = (unsigned char)*P++;
+}
+
+// gettok() for in-memory sources - works on the buffer directly instead of a char at a time
+static int gettokBuffer()
+{
+    const char *Base = SrcCur;
+    LexedToken T;
+    lexToken(SrcCur, SrcEnd, Base, T);
+    if (T.Kind == tok_number)
+        NumVal = T.Num;
+    else if (T.Kind == tok_string)
+        StrVal.assign(Base + T.Offset, T.Len);
+    else if (T.Len) // identifiers and keywords
+        IdentifierStr.assign(Base + T.Offset, T.Len);
+    return T.Kind;
+}
+
+bool TokenizeLexerSource(vector<LexedToken> &Toks, const char *&Base)
+{
+    if (!FromString)
+        return false;
+
+    Base = SrcCur;
+    // tokens are usually ~4-6 chars of source each, don't regrow the array over and over
+    Toks.reserve(Toks.size() + (SrcEnd - SrcCur) / 4 + 1);
+    LexedToken T;
+    do
+    {
+        lexToken(SrcCur, SrcEnd, Base, T);
+        Toks.push_back(T);
+    } while (T.Kind != tok_eof);
+    return true;
+}
+
+// read the next raw char from whichever source is active
+static int nextChar()
+{
+    if (!FromString)
+        return getchar();
+    if (SrcCur == SrcEnd)
+        return EOF;
+    return (unsigned char)*SrcCur++;
+}
+
 // gettok - Return next token from std. input
 int gettok()
 {
     // TODO: enforce formatting rules here
 
-    static int LastChar = ' '; // previous char
+    if (FromString)
+        return gettokBuffer();
 
     // skip whitespace
     // reads characters one at a time from stdin
     // eats them as it reads them, stores last char red (but not processed) in LastChar
     while (isspace(LastChar))
-        LastChar = getchar();
+        LastChar = nextChar();
 
     // if LastChar is a letter, it's part of an identifier
     if (isalpha(LastChar)) // identifier: a-z, A-Z, 0-9
@@ -38,26 +408,12 @@ int gettok()
 
         // get the full identifier
         // isalnum() checks if a char is a decimal digit OR an upper/lowercase letter
-        while (isalnum((LastChar = getchar())))
+        while (isalnum((LastChar = nextChar())))
             IdentifierStr += LastChar;
 
-        // if token is "def" or "extern," return those corresponding tokens
+        // if token is a keyword ("def", "extern", ...), return its token
         // else return that it is an identifier -> name of var/function/extern
-        if (IdentifierStr == "def")
-            return tok_def;
-        if (IdentifierStr == "extern")
-            return tok_extern;
-        if (IdentifierStr == "if")
-            return tok_if;
-        if (IdentifierStr == "then")
-            return tok_then;
-        if (IdentifierStr == "else")
-            return tok_else;
-        if (IdentifierStr == "for")
-            return tok_for;
-        if (IdentifierStr == "in")
-            return tok_in;
-        return tok_identifier;
+        return lookupKeyword(IdentifierStr.data(), IdentifierStr.size());
     }
 
     // if char is any of the things that make up a double - a number or a decimal, it's a number
@@ -69,7 +425,7 @@ int gettok()
         do
         {
             NumStr += LastChar;
-            LastChar = getchar();
+            LastChar = nextChar();
 
         } while (isdigit(LastChar) || LastChar == '.');
 
@@ -83,7 +439,7 @@ int gettok()
         // comment lasts until end of line
         do
         {
-            LastChar = getchar();
+            LastChar = nextChar();
         } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r'); // all possible EOFs, including the one defined by this language
 
         if (LastChar != EOF)
@@ -93,20 +449,19 @@ int gettok()
     // is string if starts with '"'
     if (LastChar == '\"')
     {
-        string currStr;       // stores string as it is parsed
-        LastChar = getchar(); // eat first '"' char
+        string currStr;        // stores string as it is parsed
+        LastChar = nextChar(); // eat first '"' char
 
         // TODO: implement escape character
-        do
+        while (LastChar != '\"' && LastChar != EOF) // string ends with another '"' (or the input runs out)
         {
             currStr += LastChar;
-            LastChar = getchar();
+            LastChar = nextChar();
+        }
 
-        } while (LastChar != '\"'); // string ends with another '"'
-
-        LastChar = getchar(); // eat '"' character
-        StrVal = currStr;     // store string parsed in global StrVal
-        return tok_string;    // return that we found a string
+        LastChar = nextChar(); // eat '"' character
+        StrVal = currStr;      // store string parsed in global StrVal
+        return tok_string;     // return that we found a string
     }
 
     // all other cases
@@ -115,7 +470,13 @@ int gettok()
         return tok_eof;
 
     // otherwise return char as its ascii value, we dk what else to do with it
+    // (unless it and the next one make an operator like <=)
     int ThisChar = LastChar;
-    LastChar = getchar();
+    LastChar = nextChar();
+    if (int Op = lookupTwoCharOp(ThisChar, LastChar))
+    {
+        LastChar = nextChar();
+        return Op;
+    }
     return ThisChar;
 }
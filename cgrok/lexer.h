@@ -1,7 +1,9 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 /*
 ----PURPOSE:
@@ -36,10 +38,66 @@ enum Token
     tok_in = -10,
 
     // other data types
-    tok_string = -11
+    tok_string = -11,
+
+    // modules
+    tok_import = -12,
+
+    // operators longer than one char (single char operators are just the char)
+    tok_le = -13,  // <=
+    tok_ge = -14,  // >=
+    tok_eq = -15,  // ==
+    tok_ne = -16,  // !=
+    tok_and = -17, // &&
+    tok_or = -18,  // ||
+
+    // generators
+    tok_yield = -19,
 };
 
-// gettok - Return next token from std. input
+// one lexed token, as stored in a token array
+// identifier/keyword names and string contents are Len chars at Offset in the token text
+// (see TokenizeLexerSource), numbers carry their value
+struct LexedToken
+{
+    int Kind; // a Token enum value or a char
+    uint32_t Offset;
+    uint32_t Len;
+    double Num;
+};
+
+// gettok - Return next token from std. input (or the string set by SetLexerSource)
 int gettok();
 
+// point the lexer at an in-memory source string instead of stdin
+// the string must stay alive until the lexer hits tok_eof
+void SetLexerSource(const std::string &Src);
+void SetLexerStdin();
+
+// where the lexer is in its current source, so another one can be lexed in between
+struct LexerState
+{
+    bool FromString;
+    const char *SrcCur;
+    const char *SrcEnd;
+    int LastChar;
+};
+
+LexerState SaveLexerState();
+// pick up where S left off (counts as a new source, see LexerGeneration)
+void RestoreLexerState(const LexerState &S);
+
+// bumped whenever the lexer is pointed at a new source
+// anything holding tokens lexed from the old one should drop them
+extern unsigned LexerGeneration;
+
+// lex everything left in the in-memory source in one pass, appending to Toks (ends with tok_eof).
+// Base is set to what the tokens' Offsets are relative to.
+// returns false if the lexer is reading stdin a char at a time instead
+bool TokenizeLexerSource(std::vector<LexedToken> &Toks, const char *&Base);
+
+// if stdin is a regular file, read all of it now and lex it from memory (much faster
+// than a char at a time). returns false for a terminal or pipe, which are lexed as they come
+bool LoadLexerStdin();
+
 #endif
@@ -8,6 +8,8 @@
 #include "llvm/Support/TargetSelect.h"
 #include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
@@ -17,6 +19,13 @@
 #include "parser.h"
 #include "codegen.h"
 #include "toplevel.h"
+#include "runtime.h"
+#include "input.h"
+#include "stats.h"
+#include "jitevents.h"
+#include "host.h"
+#include "watch.h"
+#include "grkc.h"
 
 using namespace std;
 using namespace llvm;
@@ -30,103 +39,165 @@ using namespace llvm::orc;
 */
 
 // ----------------------------------------------------------------------------------------------
-// == LIBRARY FUNCTIONS ========================================================================
+// ==DRIVER CODE ===================================================================================
 // ----------------------------------------------------------------------------------------------
 
-// on windows, export the functions because dynamic symbol loader will use
-// GetProcAddress to find symbols
-#if defined(_MSC_VER)
-    #define EXPORT __declspec(dllexport)
-    #define IMPORT __declspec(dllimport)
-#elif defined(__GNUC__)
-    #define EXPORT __attribute__((visibility("default")))
-    #define IMPORT
-#else
-    #define EXPORT
-    #define IMPORT
-#endif
-
-
-
-// PRODUCE CONSOLE OUTPUT USING C ----
-
-// putchard - putchar takes a double ASCII value and returns 0
-// writes a single char from ASCII to stdout 
-
-extern "C" EXPORT double putchard(double X)
-{
-    fputc((char)X, stderr);
-    return 0;
-}
-
-
-// printd - printf that takes a double and prints with new line, returns 0
-extern "C" EXPORT double printd(double X)
-{
-    fprintf(stderr, "%f\n", X);
-    return 0;
-}
-
-// printstr - printf that takes string and prints with newline, returns 0
-extern "C" EXPORT char printstr(char S[])
-{
-    fprintf(stderr, "%s\n", S);
-    return 0;
-}
-
-extern "C" EXPORT char* concatstr(char S1[], char S2[])
+int main(int argc, char *argv[])
 {
-     int lengthOfStr1 = strlen(S1);
-     int lengthOfStr2 = strlen(S2);
-     char *result = (char*)malloc(lengthOfStr1 + lengthOfStr2);
-     int i= 0;
-     printf("%s\n", S1);
-     while (S1[i] != '\0') {
-        if (result[i] == '\0') {
-            result[i] = S1[i];
+    bool StatsJSON = false;
+    const char *TargetCPU = ""; // host CPU
+    vector<string> WatchPaths;
+    vector<string> LoadPaths;
+    const char *CompileSrc = nullptr, *CompileOut = nullptr;
+    bool WithObjects = true;
+
+    // command line options
+    //  --stdout       send builtin output to stdout instead of stderr
+    //  -o <file>      send builtin output to a file
+    //  --input <file> open a data file for the input builtins, the first is input 0 (repeatable)
+    //  --expr-cache <n>  keep the last n compiled top-level expressions (0 = off)
+    //  --no-interp    always JIT compile top-level expressions
+    //  --stats[=json] print per-phase timings and counts at exit
+    //  --time-passes  --stats plus LLVM's per-pass timings
+    //  --fp-mode <strict|contract|fast>  floating point semantics (default strict)
+    //  --fast-math    same as --fp-mode fast
+    //  --target-cpu <cpu>  compile for a baseline CPU (ie. x86-64-v2) instead of this machine's
+    //  --gdb          register JIT'd code with the GDB JIT interface
+    //  --perf         write a perf map for JIT'd code
+    //  --watch <file> load file and reload it whenever it changes, only recompiling
+    //                 the defs that changed (repeat for more files)
+    //  --compile <src.grk> <out.grkc>  precompile a library into a module file and exit
+    //  --bitcode-only leave native code out of --compile's module (load on any CPU)
+    //  --load <file.grkc>  load a precompiled module before reading input (repeatable)
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--stdout") == 0)
+            RuntimeOutputToStream(stdout);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            if (!RuntimeOutputToFile(argv[++i]))
+            {
+                fprintf(stderr, "Error: could not open output file %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+        {
+            if (OpenInput(argv[++i]) < 0)
+                return 1;
+        }
+        else if (strcmp(argv[i], "--expr-cache") == 0 && i + 1 < argc)
+        {
+            i++;
+            char *End;
+            errno = 0;
+            unsigned long N = strtoul(argv[i], &End, 10);
+            // strtoul takes "-1" as ULONG_MAX, so only plain digits are a size
+            if (!isdigit((unsigned char)argv[i][0]) || *End != '\0' || errno == ERANGE || N > UINT_MAX)
+            {
+                fprintf(stderr, "Error: bad expression cache size %s (a count, 0 = off)\n", argv[i]);
+                return 1;
+            }
+            SetExprCacheSize(N);
+        }
+        else if (strcmp(argv[i], "--no-interp") == 0)
+            SetInterpreterEnabled(false);
+        else if (strcmp(argv[i], "--stats") == 0)
+            EnableStats(false);
+        else if (strcmp(argv[i], "--stats=json") == 0)
+        {
+            EnableStats(false);
+            StatsJSON = true;
+        }
+        else if (strcmp(argv[i], "--time-passes") == 0)
+            EnableStats(true);
+        else if (strcmp(argv[i], "--fp-mode") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "strict") == 0)
+                SetFPMode(FP_STRICT);
+            else if (strcmp(argv[i], "contract") == 0)
+                SetFPMode(FP_CONTRACT);
+            else if (strcmp(argv[i], "fast") == 0)
+                SetFPMode(FP_FAST);
+            else
+            {
+                fprintf(stderr, "Error: unknown fp mode %s (strict, contract or fast)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--fast-math") == 0)
+            SetFPMode(FP_FAST);
+        else if (strcmp(argv[i], "--target-cpu") == 0 && i + 1 < argc)
+            TargetCPU = argv[++i];
+        else if (strcmp(argv[i], "--gdb") == 0)
+            EnableGDBJITInterface();
+        else if (strcmp(argv[i], "--perf") == 0)
+            EnablePerfSupport();
+        else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+            WatchPaths.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--compile") == 0 && i + 2 < argc)
+        {
+            CompileSrc = argv[++i];
+            CompileOut = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bitcode-only") == 0)
+            WithObjects = false;
+        else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+            LoadPaths.push_back(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [--stdout] [-o <file>] [--input <file>]... [--expr-cache <n>] [--no-interp] [--stats[=json]] [--time-passes] [--fp-mode <mode>] [--fast-math] [--target-cpu <cpu>] [--gdb] [--perf] [--watch <file>]... [--compile <src> <out>] [--bitcode-only] [--load <file.grkc>]...\n", argv[0]);
+            return 1;
         }
-        i++;
     }
-     strcat(result, S2);
-     return result;
-}
-
 
-// ----------------------------------------------------------------------------------------------
-// ==DRIVER CODE ===================================================================================
-// ----------------------------------------------------------------------------------------------
-
-int main()
-{
     // prepare environment and initialize JIT
     InitializeNativeTarget();
     InitializeNativeTargetAsmPrinter();
     InitializeNativeTargetAsmParser();
 
     // install std binary ops
-    // 1 is lowest precedence
-    BinopPrecedence['<'] = 10;
-    BinopPrecedence['>'] = 10;
-    BinopPrecedence['+'] = 20;
-    BinopPrecedence['-'] = 20;
-    BinopPrecedence['%'] = 40;
-    BinopPrecedence['/'] = 40;
-    BinopPrecedence['*'] = 40; // highest
+    InstallStdBinops();
 
-    // prime first token
-    fprintf(stderr, "ready>\n");
-    getNextToken();
+    // scripts redirected from a file get lexed straight from memory
+    // (watch and compile mode read their files instead)
+    if (WatchPaths.empty() && !CompileSrc)
+    {
+        LoadLexerStdin();
+
+        // prime first token
+        fprintf(stderr, "ready>\n");
+        getNextToken();
+    }
 
-    TheJIT = ExitOnErr(KaleidoscopeJIT::Create());
+    TheJIT = ExitOnErr(KaleidoscopeJIT::Create(TargetCPU));
+    InstallJITStats();
+    InstallJITEventListeners();
+    InstallHostBuiltins();
 
     // make a module to hold the code
     InitializeModuleAndManagers();
 
+    if (CompileSrc)
+        return CompileModuleFile(CompileSrc, CompileOut, WithObjects) ? 0 : 1;
+
+    for (auto &Path : LoadPaths)
+        if (!LoadModuleFile(Path))
+            return 1;
+
+    // watch mode runs until killed
+    if (!WatchPaths.empty())
+        WatchFiles(WatchPaths);
+
     // run main loop
     MainLoop();
 
     // print out generated code
     TheModule->print(errs(), nullptr);
 
+    if (StatsEnabled)
+        PrintStats(StatsJSON);
+
     return 0;
 }
@@ -14,9 +14,177 @@ using namespace std; // used for unique_ptr
 
 // CurTok/getNextToken - provide token buffer around lexer
 int CurTok;
+
+// the tokens the parser reads, by index. an in-memory source is lexed into this all at once,
+// interactive stdin a token at a time as the parser asks for them
+static vector<LexedToken> Toks;
+static size_t TokPos = 0;             // index of CurTok in Toks
+static const char *TokText = nullptr; // what token Offsets point into, for in-memory sources
+static string StreamText;             // token text when lexing stdin (can move as it grows)
+static bool Streaming = false;
+static unsigned TokGeneration = ~0u;  // LexerGeneration the tokens came from
+
+// lex onto the end of Toks - the rest of the source if it's in memory, else one token
+static void lexMore()
+{
+    PhaseTimer T(PHASE_LEX);
+    if (TokenizeLexerSource(Toks, TokText))
+    {
+        Streaming = false;
+        return;
+    }
+
+    Streaming = true;
+    LexedToken Tok = {gettok(), (uint32_t)StreamText.size(), 0, 0};
+    if (Tok.Kind == tok_identifier)
+    {
+        StreamText += IdentifierStr;
+        Tok.Len = IdentifierStr.size();
+    }
+    else if (Tok.Kind == tok_string)
+    {
+        StreamText += StrVal;
+        Tok.Len = StrVal.size();
+    }
+    else if (Tok.Kind == tok_number)
+        Tok.Num = NumVal;
+    Toks.push_back(Tok);
+}
+
+// name of an identifier token, or contents of a string token
+static string tokText(const LexedToken &Tok)
+{
+    const char *Base = Streaming ? StreamText.data() : TokText;
+    return string(Base + Tok.Offset, Tok.Len);
+}
+
+static string curText() { return tokText(Toks[TokPos]); }
+static double curNum() { return Toks[TokPos].Num; }
+
+static bool Recording = false;
+static string RecordedToks;
+static size_t LastTokStart = string::npos; // where the lookahead token starts in RecordedToks
+
+// append CurTok (and its value, if it has one) to the recorded key
+static void recordCurTok()
+{
+    LastTokStart = RecordedToks.size();
+    RecordedToks += to_string(CurTok);
+    switch (CurTok)
+    {
+    case tok_identifier:
+        RecordedToks += ':' + curText();
+        break;
+    case tok_number:
+    {
+        // by value, so 1 and 1.0 are the same key
+        double Num = curNum();
+        RecordedToks += ':';
+        RecordedToks.append((const char *)&Num, sizeof(Num));
+        break;
+    }
+    case tok_string:
+    {
+        string Str = curText();
+        RecordedToks += ':' + to_string(Str.size()) + ':' + Str;
+        break;
+    }
+    }
+    RecordedToks += '\n';
+}
+
 int getNextToken()
 {
-    return CurTok = gettok();
+    if (TokGeneration != LexerGeneration)
+    {
+        // new source, whatever is left of the old one is gone
+        Toks.clear();
+        StreamText.clear();
+        TokPos = 0;
+        TokGeneration = LexerGeneration;
+    }
+    else
+        TokPos++;
+
+    if (TokPos >= Toks.size())
+    {
+        // used up everything lexed so far
+        Toks.clear();
+        StreamText.clear();
+        TokPos = 0;
+        lexMore();
+    }
+
+    CurTok = Toks[TokPos].Kind;
+    Stats.Tokens++;
+    if (Recording)
+        recordCurTok();
+    return CurTok;
+}
+
+int PeekToken(unsigned N)
+{
+    size_t Index = TokPos + N;
+    while (Index >= Toks.size())
+    {
+        if (Toks.empty() || Toks.back().Kind == tok_eof)
+            return tok_eof;
+        lexMore();
+    }
+    return Toks[Index].Kind;
+}
+
+// what PushParserSource saved, innermost last
+struct SavedSource
+{
+    LexerState Lexer;
+    vector<LexedToken> Toks;
+    size_t TokPos;
+    const char *TokText;
+    string StreamText;
+    bool Streaming;
+    int CurTok;
+};
+
+static vector<SavedSource> SavedSources;
+
+void PushParserSource(const string &Src)
+{
+    SavedSources.push_back({SaveLexerState(), std::move(Toks), TokPos, TokText, std::move(StreamText), Streaming, CurTok});
+    Toks.clear();
+    StreamText.clear();
+    SetLexerSource(Src);
+}
+
+void PopParserSource()
+{
+    auto &S = SavedSources.back();
+    RestoreLexerState(S.Lexer);
+    Toks = std::move(S.Toks);
+    TokPos = S.TokPos;
+    TokText = S.TokText;
+    StreamText = std::move(S.StreamText);
+    Streaming = S.Streaming;
+    CurTok = S.CurTok;
+    TokGeneration = LexerGeneration; // the saved tokens are still good
+    SavedSources.pop_back();
+}
+
+void StartTokenRecording()
+{
+    RecordedToks.clear();
+    Recording = true;
+    recordCurTok(); // the current token is the first one in
+}
+
+string StopTokenRecording()
+{
+    Recording = false;
+    // the last token read is lookahead past whatever was parsed, leave it out
+    if (LastTokStart != string::npos)
+        RecordedToks.resize(LastTokStart);
+    LastTokStart = string::npos;
+    return std::move(RecordedToks);
 }
 
 // error handling helper functions
@@ -37,7 +205,7 @@ unique_ptr<PrototypeAST> LogErrorP(const char *Str)
 // takes current value, makes a NumberExprAST node, advances, returns
 static unique_ptr<ExprAST> ParseNumberExpr()
 {
-    auto Result = make_unique<NumberExprAST>(NumVal); // make a number with the value
+    auto Result = make_unique<NumberExprAST>(curNum()); // make a number with the value
     getNextToken();                                   // consume the number
     return std::move(Result);
 }
@@ -46,7 +214,7 @@ static unique_ptr<ExprAST> ParseNumberExpr()
 // takes current value, makes StringExprAST node, advances, returns
 static unique_ptr<ExprAST> ParseStrExpr()
 {
-    auto Result = make_unique<StringExprAST>(StrVal); // make a string with the value
+    auto Result = make_unique<StringExprAST>(curText()); // make a string with the value
     getNextToken();
     return std::move(Result);
 }
@@ -71,7 +239,7 @@ static unique_ptr<ExprAST> ParseParenExpr()
 // called if current token is a tok_identifier token, recursion and error handling
 static unique_ptr<ExprAST> ParseIdentifierExpr()
 {
-    string IdName = IdentifierStr;
+    string IdName = curText();
 
     getNextToken(); // eat identifier
 
@@ -141,7 +309,7 @@ static unique_ptr<ExprAST> ParseForExpr()
     if (CurTok != tok_identifier)
         return LogError("Expected identifier after for.");
 
-    string IdName = IdentifierStr;
+    string IdName = curText();
     getNextToken(); // eat identifier
 
     if (CurTok != '=')
@@ -151,6 +319,22 @@ static unique_ptr<ExprAST> ParseForExpr()
     auto Start = ParseExpression();
     if (!Start)
         return nullptr;
+
+    // for x = gen(args) in body - no end condition, the generator decides when it's done
+    if (CurTok == tok_in)
+    {
+        unique_ptr<CallExprAST> Seq(dynamic_cast<CallExprAST *>(Start.get()));
+        if (!Seq)
+            return LogError("expected ',' after for's start value (or a generator call)");
+        Start.release();
+        getNextToken(); // eat 'in'
+
+        auto Body = ParseExpression();
+        if (!Body)
+            return nullptr;
+        return make_unique<ForEachExprAST>(IdName, std::move(Seq), std::move(Body));
+    }
+
     if (CurTok != ',')
         return LogError("expected ',' after for's start value");
     getNextToken();
@@ -180,6 +364,20 @@ static unique_ptr<ExprAST> ParseForExpr()
     return make_unique<ForExprAST>(IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body));
 }
 
+// set by every yield parsed, a def with one is a generator
+static bool SawYield = false;
+
+// ::= 'yield' expression
+static unique_ptr<ExprAST> ParseYieldExpr()
+{
+    getNextToken(); // eat 'yield'
+    auto Val = ParseExpression();
+    if (!Val)
+        return nullptr;
+    SawYield = true;
+    return make_unique<YieldExprAST>(std::move(Val));
+}
+
 // primary
 //  ::= identifierexpr
 //  ::= numberexpr
@@ -203,62 +401,65 @@ static unique_ptr<ExprAST> ParsePrimary()
         return ParseForExpr();
     case tok_string:
         return ParseStrExpr();
+    case tok_yield:
+        return ParseYieldExpr();
     }
 }
 
 // operator precendence parsing
-// holds precedence for every binary operator defined
-map<char, int> BinopPrecedence;
+int BinopPrecedence[OP_TABLE_SIZE];
+
+void InstallStdBinops()
+{
+    // 1 is lowest precedence
+    BinopPrecedence[OpSlot(tok_or)] = 4;
+    BinopPrecedence[OpSlot(tok_and)] = 6;
+    BinopPrecedence[OpSlot(tok_eq)] = 8;
+    BinopPrecedence[OpSlot(tok_ne)] = 8;
+    BinopPrecedence[OpSlot('<')] = 10;
+    BinopPrecedence[OpSlot('>')] = 10;
+    BinopPrecedence[OpSlot(tok_le)] = 10;
+    BinopPrecedence[OpSlot(tok_ge)] = 10;
+    BinopPrecedence[OpSlot('+')] = 20;
+    BinopPrecedence[OpSlot('-')] = 20;
+    BinopPrecedence[OpSlot('%')] = 40;
+    BinopPrecedence[OpSlot('/')] = 40;
+    BinopPrecedence[OpSlot('*')] = 40; // highest
+}
 
 // get precedence of preceding binary op token
 static int GetTokPrecendence()
 {
-    if (!isascii(CurTok))
-        return -1;
-
-    // make sure declared binop
-    int TokPrec = BinopPrecedence[CurTok];
-    if (TokPrec <= 0)
+    int Slot = OpSlot(CurTok);
+    if (Slot < 0 || BinopPrecedence[Slot] <= 0)
         return -1;
-    return TokPrec;
+    return BinopPrecedence[Slot];
 }
 
-// ::= ('+' primary)*
+// ::= (binop primary)*
+// Pratt loop: folds every operator binding at least as tightly as ExprPrec into LHS.
+// the operand after an operator takes everything binding tighter than that operator,
+// so operators of equal precedence associate to the left
 static unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, unique_ptr<ExprAST> LHS)
 {
-
-    // if binop, find its precendence
     while (true)
     {
         int TokPrec = GetTokPrecendence();
-
-        // if this is a binop that binds at least as tightly as the current one consume it,
-        // otherwise we are done
         if (TokPrec < ExprPrec)
             return LHS;
 
         int BinOp = CurTok;
         getNextToken(); // eat binop
 
-        // parse primary exp after binary operator
         auto RHS = ParsePrimary();
         if (!RHS)
             return nullptr;
-
-        // if binop binds less tightly with RHS than the operator after RHS,
-        // let the binding operator take RHS as its LHS
-        int NextPrec = GetTokPrecendence();
-        if (TokPrec < NextPrec)
-        {
-            RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
-            if (!RHS)
-                return nullptr;
-        }
+        RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
+        if (!RHS)
+            return nullptr;
 
         // merge LHS/RHS
         LHS = make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
-
-        // top of while loop again
     }
 }
 
@@ -277,7 +478,7 @@ static unique_ptr<PrototypeAST> ParsePrototype()
     if (CurTok != tok_identifier)
         return LogErrorP("Expected function name in prototype.");
 
-    string FnName = IdentifierStr;
+    string FnName = curText();
     getNextToken();
 
     if (CurTok != '(')
@@ -286,7 +487,7 @@ static unique_ptr<PrototypeAST> ParsePrototype()
     // read list of arg names
     vector<string> ArgNames;
     while (getNextToken() == tok_identifier)
-        ArgNames.push_back(IdentifierStr);
+        ArgNames.push_back(curText());
 
     if (CurTok != ')')
         return LogErrorP("Expected ')' in prototype");
@@ -301,32 +502,171 @@ static unique_ptr<PrototypeAST> ParsePrototype()
 // function def = prototype wwith expression to implement the body
 unique_ptr<FunctionAST> ParseDefinition()
 {
+    PhaseTimer T(PHASE_PARSE);
     getNextToken(); // eat def
     auto Proto = ParsePrototype();
     if (!Proto)
         return nullptr;
 
+    SawYield = false;
     if (auto E = ParseExpression())
-        return make_unique<FunctionAST>(std::move(Proto), std::move(E));
+    {
+        if (SawYield)
+            Proto->setGenerator();
+        auto Fn = make_unique<FunctionAST>(std::move(Proto), std::move(E));
+        Fn->simplify(); // fold constants before codegen sees it
+        return Fn;
+    }
     return nullptr;
 }
 
+// the same grammar as ParsePrimary/ParseExpression, only stepping over tokens.
+// it ends exactly where the real parse would, so whatever follows the body (another
+// def or a top-level expression) is left alone. false on a malformed body
+static bool SkipExpression();
+
+static bool SkipPrimary()
+{
+    switch (CurTok)
+    {
+    case tok_number:
+    case tok_string:
+        getNextToken();
+        return true;
+    case tok_identifier:
+        if (getNextToken() != '(')
+            return true;
+        if (getNextToken() != ')')
+        {
+            while (true)
+            {
+                if (!SkipExpression())
+                    return false;
+                if (CurTok == ')')
+                    break;
+                if (CurTok != ',')
+                    return false;
+                getNextToken();
+            }
+        }
+        getNextToken(); // eat ')'
+        return true;
+    case '(':
+        getNextToken();
+        if (!SkipExpression() || CurTok != ')')
+            return false;
+        getNextToken();
+        return true;
+    case tok_if:
+        getNextToken();
+        if (!SkipExpression() || CurTok != tok_then)
+            return false;
+        getNextToken();
+        if (!SkipExpression() || CurTok != tok_else)
+            return false;
+        getNextToken();
+        return SkipExpression();
+    case tok_for:
+        if (getNextToken() != tok_identifier || getNextToken() != '=')
+            return false;
+        getNextToken();
+        if (!SkipExpression())
+            return false;
+        // for x = gen(args) in body has no end or step
+        while (CurTok == ',')
+        {
+            getNextToken();
+            if (!SkipExpression())
+                return false;
+        }
+        if (CurTok != tok_in)
+            return false;
+        getNextToken();
+        return SkipExpression();
+    case tok_yield:
+        SawYield = true;
+        getNextToken();
+        return SkipExpression();
+    default:
+        return false;
+    }
+}
+
+static bool SkipExpression()
+{
+    if (!SkipPrimary())
+        return false;
+    while (GetTokPrecendence() > 0)
+    {
+        getNextToken(); // eat binop
+        if (!SkipPrimary())
+            return false;
+    }
+    return true;
+}
+
+// definition with only the prototype parsed - the body is stepped over without building an AST
+unique_ptr<PrototypeAST> ParseDefinitionPrototype()
+{
+    PhaseTimer T(PHASE_PARSE);
+    getNextToken(); // eat def
+    auto Proto = ParsePrototype();
+    if (!Proto)
+        return nullptr;
+
+    SawYield = false;
+    if (!SkipExpression())
+        return LogErrorP("malformed function body");
+    if (SawYield)
+        Proto->setGenerator();
+    return Proto;
+}
+
 // external ::= 'extern' prototype
 // prototype with no body
 unique_ptr<PrototypeAST> ParseExtern()
 {
+    PhaseTimer T(PHASE_PARSE);
     getNextToken(); // eat 'extern'
-    return ParsePrototype();
+    auto Proto = ParsePrototype();
+    if (Proto)
+        Proto->setExtern();
+    return Proto;
+}
+
+// import ::= 'import' string
+string ParseImport()
+{
+    PhaseTimer T(PHASE_PARSE);
+    getNextToken(); // eat 'import'
+    if (CurTok != tok_string)
+    {
+        LogError("Expected a file name string after import");
+        return "";
+    }
+    string Path = curText();
+    getNextToken();
+    return Path;
 }
 
 // ::= expression
-unique_ptr<FunctionAST> ParseTopLevelExpr()
+unique_ptr<FunctionAST> ParseTopLevelExpr(const string &Name, vector<string> ArgNames)
 {
+    PhaseTimer T(PHASE_PARSE);
+    SawYield = false;
     if (auto E = ParseExpression())
     {
+        if (SawYield)
+        {
+            LogError("yield outside a def");
+            return nullptr;
+        }
+
         // anonymous proto
-        auto Proto = make_unique<PrototypeAST>("__anon_expr", vector<string>());
-        return make_unique<FunctionAST>(std::move(Proto), std::move(E));
+        auto Proto = make_unique<PrototypeAST>(Name, std::move(ArgNames));
+        auto Fn = make_unique<FunctionAST>(std::move(Proto), std::move(E));
+        Fn->simplify();
+        return Fn;
     }
     return nullptr;
 }
@@ -9,16 +9,49 @@
 using namespace std; // used for unique_ptr
 
 // operator precendence parsing
-// holds precedence for every binary operator defined
-extern map<char, int> BinopPrecedence;
+// precedence of every binary operator, indexed by token kind (see OpSlot), 0 = not an operator
+// dense so the parser's check of every token after an operand is a single load
+#define OP_TABLE_SIZE (256 + 32)
+extern int BinopPrecedence[OP_TABLE_SIZE];
+
+// slot of token kind Tok in the operator table: chars are themselves, the lexer's negative
+// token kinds come after them. -1 if Tok can't be an operator
+inline int OpSlot(int Tok)
+{
+    if (Tok >= 0 && Tok < 256)
+        return Tok;
+    if (Tok < 0 && Tok >= -32)
+        return 255 - Tok;
+    return -1;
+}
+
+// install the standard binary operators into BinopPrecedence
+void InstallStdBinops();
 
 static unique_ptr<ExprAST> ParseExpression();
 static unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, unique_ptr<ExprAST> LHS);
 
 // CurTok/getNextToken - provide token buffer around lexer
+// the parser reads from an array of tokens (see LexedToken), so it can look ahead any distance
 extern int CurTok;
 int getNextToken();
 
+// parse another in-memory source in the middle of the current one (ie. an imported file)
+// Push saves where the parser and lexer are and points them at Src (call getNextToken() to start),
+// Pop puts them back exactly where they were, CurTok included
+void PushParserSource(const string &Src);
+void PopParserSource();
+
+// kind of the token N past CurTok (PeekToken(0) == CurTok), tok_eof past the end.
+// on interactive stdin this has to wait for the user to type that far
+int PeekToken(unsigned N);
+
+// token recording - everything consumed between start and stop gets appended
+// to a normalized key (token kinds + values, no whitespace/comments)
+// used to recognize the same top-level expression when it is typed again
+void StartTokenRecording();
+string StopTokenRecording();
+
 // error handling helper functions
 unique_ptr<ExprAST> LogError(const char *Str);
 unique_ptr<PrototypeAST> LogErrorP(const char *Str);
@@ -38,8 +71,15 @@ static unique_ptr<ExprAST> ParseParenExpr(); // parenexpr ::= '(' expression ')'
 static unique_ptr<ExprAST> ParseIdentifierExpr();
 
 static unique_ptr<ExprAST> ParseIfExpr();
+
+// for ::= 'for' identifier '=' expression ',' expression (',' expression)? 'in' expression
+//     ::= 'for' identifier '=' identifier '(' expression* ')' 'in' expression   (over a generator)
 static unique_ptr<ExprAST> ParseForExpr();
 
+// yield ::= 'yield' expression
+// a def with a yield in it is a generator
+static unique_ptr<ExprAST> ParseYieldExpr();
+
 // primary
 //  ::= identifierexpr
 //  ::= numberexpr
@@ -61,11 +101,20 @@ static unique_ptr<PrototypeAST> ParsePrototype();
 // function def = prototype wwith expression to implement the body
 unique_ptr<FunctionAST> ParseDefinition();
 
+// 'def' prototype, with the body skipped instead of parsed (for when only prototypes are needed)
+unique_ptr<PrototypeAST> ParseDefinitionPrototype();
+
 // external ::= 'extern' prototype
 // prototype with no body
 unique_ptr<PrototypeAST> ParseExtern();
 
+// import ::= 'import' string
+// returns the file name, or "" (after logging) if there isn't one
+string ParseImport();
+
 // ::= expression
-unique_ptr<FunctionAST> ParseTopLevelExpr();
+// wrapped in an anonymous function called Name, taking ArgNames as parameters
+unique_ptr<FunctionAST> ParseTopLevelExpr(const string &Name = "__anon_expr",
+                                          vector<string> ArgNames = vector<string>());
 
 #endif
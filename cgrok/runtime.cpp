@@ -0,0 +1,180 @@
+#include "runtime.h"
+
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// ----------------------------------------------------------------------------------------------
+// RUNTIME OUTPUT ===============================================================================
+// ----------------------------------------------------------------------------------------------
+
+// where flushed output ends up, stderr unless told otherwise
+static FILE *OutStream = stderr;
+
+// per-thread output buffer
+// the destructor runs when the thread exits (or at exit() for the main thread),
+// so anything still sitting in the buffer gets written out
+struct OutputBuffer
+{
+    char Data[RUNTIME_BUF_SIZE];
+    size_t Len = 0;
+
+    void flush()
+    {
+        if (Len == 0)
+            return;
+        fwrite(Data, 1, Len, OutStream);
+        fflush(OutStream);
+        Len = 0;
+    }
+
+    ~OutputBuffer() { flush(); }
+};
+
+static thread_local OutputBuffer OutBuf;
+
+void RuntimeOutputToStream(FILE *Stream)
+{
+    RuntimeFlush(); // don't send old output to the new stream
+    OutStream = Stream;
+}
+
+bool RuntimeOutputToFile(const char *Path)
+{
+    FILE *F = fopen(Path, "w");
+    if (!F)
+        return false;
+    RuntimeOutputToStream(F);
+    return true;
+}
+
+void RuntimeWrite(const char *Data, size_t Len)
+{
+    // too big to ever fit, don't bother copying it
+    if (Len >= RUNTIME_BUF_SIZE)
+    {
+        OutBuf.flush();
+        fwrite(Data, 1, Len, OutStream);
+        return;
+    }
+
+    if (OutBuf.Len + Len > RUNTIME_BUF_SIZE)
+        OutBuf.flush();
+
+    memcpy(OutBuf.Data + OutBuf.Len, Data, Len);
+    OutBuf.Len += Len;
+}
+
+void RuntimeWriteChar(char C)
+{
+    if (OutBuf.Len == RUNTIME_BUF_SIZE)
+        OutBuf.flush();
+    OutBuf.Data[OutBuf.Len++] = C;
+}
+
+void RuntimeFlush()
+{
+    OutBuf.flush();
+}
+
+// ----------------------------------------------------------------------------------------------
+// == LIBRARY FUNCTIONS ========================================================================
+// ----------------------------------------------------------------------------------------------
+
+// on windows, export the functions because dynamic symbol loader will use
+// GetProcAddress to find symbols
+#if defined(_MSC_VER)
+    #define EXPORT __declspec(dllexport)
+    #define IMPORT __declspec(dllimport)
+#elif defined(__GNUC__)
+    #define EXPORT __attribute__((visibility("default")))
+    #define IMPORT
+#else
+    #define EXPORT
+    #define IMPORT
+#endif
+
+
+
+// PRODUCE CONSOLE OUTPUT USING C ----
+// output goes through the buffered output layer above instead of
+// hitting stderr on every call. use flushd() to force it out early.
+
+// putchard - putchar takes a double ASCII value and returns 0
+// writes a single char from ASCII to the runtime output
+
+extern "C" EXPORT double putchard(double X)
+{
+    RuntimeWriteChar((char)X);
+    return 0;
+}
+
+
+// printd - printf that takes a double and prints with new line, returns 0
+extern "C" EXPORT double printd(double X)
+{
+    // the longest %f there is: -DBL_MAX, 309 digits plus sign and ".000000" (318 with the newline)
+    char Buf[DBL_MAX_10_EXP + 32];
+    int Len = snprintf(Buf, sizeof(Buf), "%f\n", X);
+    RuntimeWrite(Buf, Len);
+    return 0;
+}
+
+// printstr - printf that takes string and prints with newline, returns 0
+extern "C" EXPORT char printstr(char S[])
+{
+    RuntimeWrite(S, strlen(S));
+    RuntimeWriteChar('\n');
+    return 0;
+}
+
+// flushd - write out everything buffered so far, returns 0
+extern "C" EXPORT double flushd(double X)
+{
+    RuntimeFlush();
+    return 0;
+}
+
+// sinkd - keeps X alive: the optimizer can't see into it, so whatever computed X has to run
+// (for benchmarks, where nothing else uses a loop's results). returns 0
+static volatile double SinkValue;
+
+extern "C" EXPORT double sinkd(double X)
+{
+    SinkValue = X;
+    return 0;
+}
+
+// small math helpers - host side of the IR bodies in host.cpp, must behave the same
+extern "C" EXPORT double mind(double A, double B)
+{
+    return A < B ? A : B;
+}
+
+extern "C" EXPORT double maxd(double A, double B)
+{
+    return A > B ? A : B;
+}
+
+extern "C" EXPORT double absd(double X)
+{
+    return X < 0 ? -X : X;
+}
+
+extern "C" EXPORT char* concatstr(char S1[], char S2[])
+{
+     int lengthOfStr1 = strlen(S1);
+     int lengthOfStr2 = strlen(S2);
+     char *result = (char*)malloc(lengthOfStr1 + lengthOfStr2);
+     int i= 0;
+     printf("%s\n", S1);
+     while (S1[i] != '\0') {
+        if (result[i] == '\0') {
+            result[i] = S1[i];
+        }
+        i++;
+    }
+     strcat(result, S2);
+     return result;
+}
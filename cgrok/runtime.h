@@ -0,0 +1,38 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <cstddef>
+#include <cstdio>
+
+/*
+----PURPOSE:
+    Output layer used by the runtime builtins (putchard, printd, printstr, ...).
+    Each thread writes into its own large buffer, which only hits the output
+    stream when it fills up, when flushd() is called, or at exit.
+*/
+
+// size of each thread's output buffer
+#define RUNTIME_BUF_SIZE (64 * 1024)
+
+// choose where builtin output goes (stderr by default)
+// returns false if the file could not be opened
+void RuntimeOutputToStream(FILE *Stream);
+bool RuntimeOutputToFile(const char *Path);
+
+// append bytes/chars to the calling thread's buffer
+void RuntimeWrite(const char *Data, size_t Len);
+void RuntimeWriteChar(char C);
+
+// push the calling thread's buffer out to the output stream
+void RuntimeFlush();
+
+// builtins callable from grok code, registered with the JIT by InstallHostBuiltins()
+extern "C" double putchard(double X);
+extern "C" double printd(double X);
+extern "C" double flushd(double X);
+extern "C" double sinkd(double X);
+extern "C" double mind(double A, double B);
+extern "C" double maxd(double A, double B);
+extern "C" double absd(double X);
+
+#endif
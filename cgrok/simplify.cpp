@@ -0,0 +1,117 @@
+#include "ast.h"
+#include "lexer.h"
+
+#include <cmath>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------------------------
+// AST SIMPLIFICATION ===========================================================================
+// ----------------------------------------------------------------------------------------------
+
+// runs on every function body before codegen (and before the interpreter sees it)
+// so constant subtrees never turn into IR for LLVM to clean up.
+// only rewrites that are exact for IEEE doubles - no fast-math tricks here
+
+// simplify a child in place
+static void simplifyChild(unique_ptr<ExprAST> &E)
+{
+    if (auto New = E->simplify())
+        E = std::move(New);
+}
+
+static bool isConstantEq(const unique_ptr<ExprAST> &E, double Want)
+{
+    double V;
+    return E->isConstant(V) && V == Want;
+}
+
+unique_ptr<ExprAST> BinaryExprAST::simplify()
+{
+    simplifyChild(LHS);
+    simplifyChild(RHS);
+
+    // both sides known -> fold. the interpreter already has the exact codegen semantics
+    double L, R;
+    if (LHS->isConstant(L) && RHS->isConstant(R) && canInterpret())
+        return make_unique<NumberExprAST>(interpret());
+
+    // the left side decides && / || on its own: 0 && x, 1 || x (x never runs)
+    if ((Op == tok_and || Op == tok_or) && LHS->isConstant(L) && (L < 0.0 || L > 0.0) == (Op == tok_or))
+        return make_unique<NumberExprAST>(Op == tok_or ? 1.0 : 0.0);
+
+    // identities: x*1, 1*x, x/1, x-0
+    // (x+0 is not one: -0.0 + 0.0 is +0.0, and neither is x-(-0.0), which is x+0.0)
+    switch (Op)
+    {
+    case '*':
+        if (isConstantEq(RHS, 1.0))
+            return std::move(LHS);
+        if (isConstantEq(LHS, 1.0))
+            return std::move(RHS);
+        break;
+    case '/':
+        if (isConstantEq(RHS, 1.0))
+            return std::move(LHS);
+        break;
+    case '-':
+        if (RHS->isConstant(R) && R == 0.0 && !std::signbit(R))
+            return std::move(LHS);
+        break;
+    }
+    return nullptr;
+}
+
+unique_ptr<ExprAST> CallExprAST::simplify()
+{
+    for (auto &Arg : Args)
+        simplifyChild(Arg);
+    return nullptr;
+}
+
+unique_ptr<ExprAST> IfExprAST::simplify()
+{
+    simplifyChild(Cond);
+    simplifyChild(Then);
+    simplifyChild(Else);
+
+    // constant condition -> only one branch can ever run
+    // same test as codegen: ordered not-equal to 0.0
+    double C;
+    if (Cond->isConstant(C))
+    {
+        if (C < 0.0 || C > 0.0)
+            return std::move(Then);
+        return std::move(Else);
+    }
+    return nullptr;
+}
+
+unique_ptr<ExprAST> ForExprAST::simplify()
+{
+    simplifyChild(Start);
+    simplifyChild(End);
+    if (Step)
+        simplifyChild(Step);
+    simplifyChild(Body);
+    return nullptr;
+}
+
+unique_ptr<ExprAST> YieldExprAST::simplify()
+{
+    simplifyChild(Val);
+    return nullptr;
+}
+
+unique_ptr<ExprAST> ForEachExprAST::simplify()
+{
+    Seq->simplify(); // never replaces itself
+    simplifyChild(Body);
+    return nullptr;
+}
+
+void FunctionAST::simplify()
+{
+    if (auto New = Body->simplify())
+        Body = std::move(New);
+}
@@ -0,0 +1,140 @@
+#include "stats.h"
+#include "codegen.h"
+
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/IR/PassTimingInfo.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// COMPILE STATISTICS ===========================================================================
+// ----------------------------------------------------------------------------------------------
+
+CompileStats Stats;
+bool StatsEnabled = false;
+
+// LLVM's own per-pass timers, only created for --time-passes
+static unique_ptr<TimePassesHandler> ThePassTimer;
+static unique_ptr<PassInstrumentationCallbacks> TimingPIC;
+
+static const char *PhaseNames[NUM_PHASES] = {"lex", "parse", "codegen", "optimize", "jit", "exec"};
+
+// stack of phases currently running, innermost on top
+static StatPhase PhaseStack[32];
+static int PhaseDepth = 0;
+static uint64_t LastSwitch = 0; // when the top of the stack last changed
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void EnterPhase(StatPhase P)
+{
+    uint64_t Now = nowNs();
+    // pause whatever was running
+    if (PhaseDepth > 0)
+        Stats.PhaseNs[PhaseStack[PhaseDepth - 1]] += Now - LastSwitch;
+    if (PhaseDepth < 32)
+        PhaseStack[PhaseDepth] = P;
+    PhaseDepth++;
+    LastSwitch = Now;
+}
+
+void LeavePhase()
+{
+    uint64_t Now = nowNs();
+    PhaseDepth--;
+    if (PhaseDepth < 32)
+        Stats.PhaseNs[PhaseStack[PhaseDepth]] += Now - LastSwitch;
+    LastSwitch = Now; // resume the outer phase
+}
+
+void EnableStats(bool TimePasses)
+{
+    StatsEnabled = true;
+    if (TimePasses && !ThePassTimer)
+    {
+        ThePassTimer = make_unique<TimePassesHandler>(/*Enabled*/ true);
+        TimingPIC = make_unique<PassInstrumentationCallbacks>();
+        ThePassTimer->registerCallbacks(*TimingPIC);
+    }
+}
+
+PassInstrumentationCallbacks *GetPassTimingCallbacks()
+{
+    return TimingPIC.get();
+}
+
+// counts the executable bytes of every graph the JIT links
+class JITStatsPlugin : public ObjectLinkingLayer::Plugin
+{
+public:
+    void modifyPassConfig(MaterializationResponsibility &MR, jitlink::LinkGraph &G,
+                          jitlink::PassConfiguration &Config) override
+    {
+        Config.PostFixupPasses.push_back([](jitlink::LinkGraph &G) -> Error
+        {
+            for (auto &Sec : G.sections())
+                if ((Sec.getMemProt() & MemProt::Exec) != MemProt::None)
+                    Stats.JITCodeBytes += jitlink::SectionRange(Sec).getSize();
+            return Error::success();
+        });
+    }
+
+    Error notifyFailed(MaterializationResponsibility &MR) override { return Error::success(); }
+    Error notifyRemovingResources(JITDylib &JD, ResourceKey K) override { return Error::success(); }
+    void notifyTransferringResources(JITDylib &JD, ResourceKey DstKey, ResourceKey SrcKey) override {}
+};
+
+void InstallJITStats()
+{
+    TheJIT->getObjectLayer().addPlugin(make_unique<JITStatsPlugin>());
+}
+
+void PrintStats(bool JSON)
+{
+    double TotalMs = 0;
+    for (int i = 0; i < NUM_PHASES; i++)
+        TotalMs += Stats.PhaseNs[i] / 1e6;
+
+    if (JSON)
+    {
+        fprintf(stderr, "{\n  \"phases_ms\": {");
+        for (int i = 0; i < NUM_PHASES; i++)
+            fprintf(stderr, "%s\"%s\": %.3f", i ? ", " : "", PhaseNames[i], Stats.PhaseNs[i] / 1e6);
+        fprintf(stderr, "},\n");
+        fprintf(stderr, "  \"tokens\": %llu,\n", (unsigned long long)Stats.Tokens);
+        fprintf(stderr, "  \"ast_nodes\": %llu,\n", (unsigned long long)Stats.ASTNodes);
+        fprintf(stderr, "  \"ir_instructions\": %llu,\n", (unsigned long long)Stats.IRInstructions);
+        fprintf(stderr, "  \"functions_compiled\": %llu,\n", (unsigned long long)Stats.FunctionsCompiled);
+        fprintf(stderr, "  \"jit_code_bytes\": %llu\n}\n", (unsigned long long)Stats.JITCodeBytes);
+    }
+    else
+    {
+        fprintf(stderr, "===---------------------------------------===\n");
+        fprintf(stderr, "  grok compile statistics\n");
+        fprintf(stderr, "===---------------------------------------===\n");
+        fprintf(stderr, "  %-12s %12s %8s\n", "phase", "time (ms)", "%");
+        for (int i = 0; i < NUM_PHASES; i++)
+        {
+            double Ms = Stats.PhaseNs[i] / 1e6;
+            fprintf(stderr, "  %-12s %12.3f %7.1f%%\n", PhaseNames[i], Ms, TotalMs > 0 ? 100 * Ms / TotalMs : 0.0);
+        }
+        fprintf(stderr, "  %-12s %12.3f\n\n", "total", TotalMs);
+        fprintf(stderr, "  %-20s %12llu\n", "tokens", (unsigned long long)Stats.Tokens);
+        fprintf(stderr, "  %-20s %12llu\n", "AST nodes", (unsigned long long)Stats.ASTNodes);
+        fprintf(stderr, "  %-20s %12llu\n", "IR instructions", (unsigned long long)Stats.IRInstructions);
+        fprintf(stderr, "  %-20s %12llu\n", "functions compiled", (unsigned long long)Stats.FunctionsCompiled);
+        fprintf(stderr, "  %-20s %12llu\n", "JIT code bytes", (unsigned long long)Stats.JITCodeBytes);
+    }
+
+    if (ThePassTimer)
+        ThePassTimer->print();
+}
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+
+namespace llvm
+{
+    class PassInstrumentationCallbacks;
+}
+
+/*
+----PURPOSE:
+    Compile-time statistics: how long each phase takes (lexing, parsing, codegen,
+    optimization, JIT, execution) plus counts of what went through it.
+    Timing is off unless turned on with --stats; the counters are always kept.
+*/
+
+enum StatPhase
+{
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_CODEGEN,
+    PHASE_OPTIMIZE,
+    PHASE_JIT,
+    PHASE_EXEC,
+    NUM_PHASES
+};
+
+struct CompileStats
+{
+    uint64_t PhaseNs[NUM_PHASES] = {}; // exclusive time - nested phases don't count twice
+    uint64_t Tokens = 0;
+    uint64_t ASTNodes = 0;
+    uint64_t IRInstructions = 0;       // after optimization
+    uint64_t FunctionsCompiled = 0;
+    uint64_t JITCodeBytes = 0;         // size of the text sections the JIT loaded
+};
+
+extern CompileStats Stats;
+extern bool StatsEnabled;
+
+// phase timing - use PhaseTimer instead of calling these directly
+void EnterPhase(StatPhase P);
+void LeavePhase();
+
+// times its scope as phase P (when stats are on)
+// phases can nest, ie. lexing inside parsing, the inner one's time is taken out of the outer
+class PhaseTimer
+{
+    bool Active;
+
+public:
+    PhaseTimer(StatPhase P) : Active(StatsEnabled)
+    {
+        if (Active)
+            EnterPhase(P);
+    }
+    ~PhaseTimer()
+    {
+        if (Active)
+            LeavePhase();
+    }
+};
+
+// turn on phase timing, and LLVM's per-pass timing (like -time-passes) if TimePasses is set
+void EnableStats(bool TimePasses);
+
+// callbacks to hand the PassBuilder so pass timing works, nullptr unless --time-passes
+llvm::PassInstrumentationCallbacks *GetPassTimingCallbacks();
+
+// hook the JIT's object layer so loaded code size gets counted
+void InstallJITStats();
+
+// dump everything to stderr, as a table or as JSON
+void PrintStats(bool JSON);
+
+#endif
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Runs the regression cases in this directory through a built cgrok.
+# Each case.grk is piped into the REPL and what its builtins print (printd, ...) is compared
+# with case.out. Errors the cases trigger on purpose go to stderr and aren't compared.
+# usage: sh run.sh path/to/k
+K=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+cd "$(dirname "$0")"
+
+Failed=0
+fail()
+{
+    echo "FAIL  $1"
+    Failed=1
+}
+
+for Case in *.grk; do
+    Name=${Case%.grk}
+    if "$K" --stdout < "$Case" 2>/dev/null | diff -u "$Name.out" -; then
+        echo "ok    $Name"
+    else
+        fail "$Name"
+    fi
+done
+
+# a simple loop over a generator has to come out as a plain loop: the generator's copy
+# inlined, and CoroElide keeping its frame off the heap
+IR=$("$K" --stdout < generators.grk 2>&1 >/dev/null | sed -n '/define double @noheap(/,/^}/p')
+if [ -z "$IR" ] || echo "$IR" | grep -q "malloc\|@upto"; then
+    fail "generator loop elision"
+else
+    echo "ok    generator loop elision"
+fi
+exit $Failed
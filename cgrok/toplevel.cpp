@@ -1,6 +1,14 @@
 #include "codegen.h"
 #include "parser.h"
 #include "lexer.h"
+#include "toplevel.h"
+#include "runtime.h"
+#include "stats.h"
+#include "import.h"
+
+#include <list>
+#include <set>
+#include <map>
 
 using namespace llvm;
 using namespace llvm::orc;
@@ -15,9 +23,11 @@ void InitializeModuleAndManagers()
     TheContext = make_unique<LLVMContext>();
     TheModule = make_unique<Module>("KaleidoscopeJIT", *TheContext);
     TheModule->setDataLayout(TheJIT->getDataLayout());
+    ModuleGenerators.clear();
 
     // create new module builder
     Builder = make_unique<IRBuilder<>>(*TheContext);
+    Builder->setFastMathFlags(GetFastMathFlags());
 
     // create new pass and analysis managers
     TheFPM = make_unique<FunctionPassManager>();
@@ -43,28 +53,113 @@ void InitializeModuleAndManagers()
     TheFPM->addPass(GVNPass());         // eliminate common subexprs
     TheFPM->addPass(SimplifyCFGPass()); // simplify control flow graph (delete unreachable blocks)
 
+    // loops - counted for loops have an integer counter (see ForExprAST::codegen())
+    // that scalar evolution can work out trip counts from
+    TheFPM->addPass(createFunctionToLoopPassAdaptor(IndVarSimplifyPass())); // canonical induction variables
+    TheFPM->addPass(LoopVectorizePass());
+    TheFPM->addPass(LoopUnrollPass());
+    TheFPM->addPass(InstCombinePass()); // clean up after them
+    TheFPM->addPass(SimplifyCFGPass());
+
     // register analysis passes used by transform passes
-    PassBuilder PB;
+    // (hooked up to LLVM's pass timers when --time-passes is on)
+    // the JIT's target machine gives them real cost info for the CPU we compile for
+    PassBuilder PB(TheJIT->getTargetMachine(), PipelineTuningOptions(), {}, GetPassTimingCallbacks());
     PB.registerModuleAnalyses(*TheMAM);
+    PB.registerCGSCCAnalyses(*TheCGAM);
     PB.registerFunctionAnalyses(*TheFAM);
+    PB.registerLoopAnalyses(*TheLAM);
     PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
 }
 
-void HandleDefinition()
+// defs that have a copy of a generator in them (see getFunction()), with the generators
+// they copied. kept so they can be compiled again when one of those is redefined
+struct CopyingDef
 {
-    if (auto FnAST = ParseDefinition())
+    unique_ptr<FunctionAST> AST;
+    set<string> Generators;
+};
+static map<string, CopyingDef> CopyingDefs;
+
+// Refresh: recompile whatever has a copy of FnAST's function if it's a generator
+static bool defineFunction(unique_ptr<FunctionAST> FnAST, bool Echo, bool Refresh)
+{
+    // a def that doesn't make it into the JIT leaves the old prototype in place
+    string Name = FnAST->getProto().getName();
+    ProtoUndo Undo;
+    Undo.save(Name);
+
+    auto *FnIR = FnAST->codegen();
+    if (!FnIR)
     {
-        if (auto *FnIR = FnAST->codegen())
-        {
-            fprintf(stderr, "Read function definition: ");
-            FnIR->print(errs());
-            fprintf(stderr, "\n");
+        Undo.restore();
+        return false;
+    }
+
+    if (Echo)
+    {
+        fprintf(stderr, "Read function definition: ");
+        FnIR->print(errs());
+        fprintf(stderr, "\n");
+    }
 
-            ExitOnErr(TheJIT->addModule(
-                ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
-            InitializeModuleAndManagers();
+    set<string> Copied = ModuleGenerators; // cleared with the module
+    bool Ok = true;
+    {
+        PhaseTimer T(PHASE_JIT);
+        // replaces (and frees) any earlier definition with the same name
+        // fails if the body calls something that can't be found
+        if (auto Err = TheJIT->addDefinition(FnIR->getName(),
+                ThreadSafeModule(std::move(TheModule), std::move(TheContext))))
+        {
+            logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+            Ok = false;
         }
     }
+    InitializeModuleAndManagers();
+    if (!Ok)
+    {
+        Undo.restore();
+        return false;
+    }
+
+    bool Generator = FnAST->getProto().isGenerator();
+    if (Copied.empty())
+        CopyingDefs.erase(Name);
+    else
+        CopyingDefs[Name] = {std::move(FnAST), std::move(Copied)};
+
+    if (!Generator || !Refresh)
+        return true;
+
+    // a new generator body: everything with a copy of the old one gets compiled again.
+    // copies of copies are listed too, so one pass does it. cached expressions can't be
+    // recompiled, they're dropped
+    ClearExprCache();
+    vector<string> Stale;
+    for (auto &[Caller, D] : CopyingDefs)
+        if (Caller != Name && D.Generators.count(Name))
+            Stale.push_back(Caller);
+    for (auto &Caller : Stale)
+    {
+        auto It = CopyingDefs.find(Caller);
+        auto AST = std::move(It->second.AST);
+        CopyingDefs.erase(It);
+        fprintf(stderr, "Recompiling %s\n", Caller.c_str());
+        defineFunction(std::move(AST), /*Echo*/ false, /*Refresh*/ false);
+    }
+    return true;
+}
+
+bool DefineFunction(unique_ptr<FunctionAST> FnAST, bool Echo)
+{
+    return defineFunction(std::move(FnAST), Echo, /*Refresh*/ true);
+}
+
+void HandleDefinition()
+{
+    if (auto FnAST = ParseDefinition())
+        DefineFunction(std::move(FnAST), /*Echo*/ true);
     else
     {
         // skip token (error recovery)
@@ -92,48 +187,178 @@ void HandleExtern()
     }
 }
 
+// ----------------------------------------------------------------------------------------------
+// COMPILED EXPRESSION CACHE ====================================================================
+// ----------------------------------------------------------------------------------------------
+
+// a top-level expression that stays in the JIT after it runs
+// so typing it again skips parsing->codegen->JIT compile
+struct CachedExpr
+{
+    string Key;            // normalized token stream of the expression
+    ResourceTrackerSP RT;  // owns the JIT'd code
+    double (*FP)();
+};
+
+// most recently used at the front
+static list<CachedExpr> ExprCache;
+static map<string, list<CachedExpr>::iterator> ExprCacheIndex;
+static unsigned ExprCacheSize = 256;
+static unsigned ExprCount = 0; // unique symbol per cached expression
+
+// interpreter tier: the first time an expression shows up it's interpreted
+// (if it can be), it only gets JIT compiled when it comes back
+static bool InterpEnabled = true;
+static set<string> SeenExprs;
+
+void SetInterpreterEnabled(bool Enabled)
+{
+    InterpEnabled = Enabled;
+}
+
+void SetExprCacheSize(unsigned N)
+{
+    ExprCacheSize = N;
+    while (ExprCache.size() > ExprCacheSize)
+    {
+        ExitOnErr(ExprCache.back().RT->remove());
+        ExprCacheIndex.erase(ExprCache.back().Key);
+        ExprCache.pop_back();
+    }
+}
+
+void ClearExprCache()
+{
+    unsigned N = ExprCacheSize;
+    SetExprCacheSize(0);
+    ExprCacheSize = N;
+}
+
+// true the first time an expression is seen (or always, if nothing gets cached)
+static bool isOneShot(const string &Key)
+{
+    if (ExprCacheSize == 0)
+        return true;
+    if (SeenExprs.size() >= 4 * ExprCacheSize)
+        SeenExprs.clear(); // don't grow forever
+    return SeenExprs.insert(Key).second;
+}
+
+string NewTopLevelExprName()
+{
+    return "__anon_expr_" + to_string(ExprCount++);
+}
+
 // use KaleidoscopeJIT.h to parse top level expressions
 // add LLVM IR module to JIT, so its functions are available for execution
 // called after parsing and codegen are done
 void HandleTopLevelExpression()
 {
     // eval top-level expr into anon function
-    if (auto FnAST = ParseTopLevelExpr())
+    string Name = NewTopLevelExprName();
+    StartTokenRecording();
+    auto FnAST = ParseTopLevelExpr(Name);
+    string Key = StopTokenRecording();
+    if (!FnAST)
     {
-        if (FnAST->codegen())
+        getNextToken();
+        return;
+    }
+
+    EvaluateTopLevelExpr(std::move(FnAST), Name, Key);
+}
+
+void EvaluateTopLevelExpr(unique_ptr<FunctionAST> FnAST, const string &Name, const string &Key)
+{
+    double (*FP)() = nullptr;
+    ResourceTrackerSP Uncached;
+
+    // seen it before - reuse the code that's already in the JIT
+    auto Hit = ExprCacheIndex.find(Key);
+    if (Hit != ExprCacheIndex.end())
+    {
+        ExprCache.splice(ExprCache.begin(), ExprCache, Hit->second);
+        FP = Hit->second->FP;
+    }
+    // the interpreter is strict IEEE, only use it when compiled code would be too
+    else if (InterpEnabled && GetFastMathFlags().none() && isOneShot(Key) && FnAST->canInterpret())
+    {
+        // cheap enough to just walk the AST, skip LLVM entirely
+        double Result;
+        {
+            PhaseTimer T(PHASE_EXEC);
+            Result = FnAST->interpret();
+        }
+        RuntimeFlush();
+        fprintf(stderr, "Evaluated to %f\n", Result);
+        return;
+    }
+    else
+    {
+        bool Ok = FnAST->codegen() != nullptr;
+        FunctionProtos.erase(Name); // nobody calls an anon expr by name
+        if (!Ok)
+            return;
+
+        // create a ResourceTracker to track JIT'd memory alloc to anon exp
+        // this way we can free it when it's evicted (or right after exec if not caching)
+        auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+
         {
-            // create a ResourceTracker to track JIT'd memory alloc to anon exp
-            // this way we can free after exec
-            auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+            PhaseTimer T(PHASE_JIT);
 
             // calling addModule triggers codegen for all functions in module, gets RT
             auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
-            ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
+            Error Err = TheJIT->addModule(std::move(TSM), RT);
 
-            // open new module to hold subsequent code
-            InitializeModuleAndManagers();
-
-            // search JIT for __anon_expr symbol
-            auto ExprSymbol = ExitOnErr(TheJIT->lookup("__anon_expr"));
-
-            // get symbol's address and cast to type
-            // call as native function
-            if (double (*FP)() = ExprSymbol.getAddress().toPtr<double (*)()>())
-                fprintf(stderr, "Evaluated to %f\n", FP());
-            if (string (*FP)() = ExprSymbol.getAddress().toPtr<string (*)()>())
-                FP();
+            // search JIT for the anon expr symbol
+            // (a call to something that can't be found fails here)
+            if (!Err)
+            {
+                auto ExprSymbol = TheJIT->lookup(Name);
+                if (ExprSymbol)
+                    FP = ExprSymbol->getAddress().toPtr<double (*)()>(); // get symbol's address and cast to type
+                else
+                    Err = ExprSymbol.takeError();
+            }
+            if (Err)
+                logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+        }
 
-            // delete anon expr module from JIT -> no re-eval
+        // open new module to hold subsequent code
+        InitializeModuleAndManagers();
+        if (!FP)
+        {
             ExitOnErr(RT->remove());
+            return;
         }
+
+        if (ExprCacheSize > 0)
+        {
+            ExprCache.push_front(CachedExpr{Key, RT, FP});
+            ExprCacheIndex[Key] = ExprCache.begin();
+            SetExprCacheSize(ExprCacheSize); // evict least recently used
+        }
+        else
+            Uncached = RT;
     }
-    else
+
+    // call as native function
+    // flush builtin output before reporting, so it shows up in order
+    double Result;
     {
-        getNextToken();
+        PhaseTimer T(PHASE_EXEC);
+        Result = FP();
     }
+    RuntimeFlush();
+    fprintf(stderr, "Evaluated to %f\n", Result);
+
+    // not caching -> delete anon expr module from JIT, no re-eval
+    if (Uncached)
+        ExitOnErr(Uncached->remove());
 }
 
-// definition | external | expression | ';'
+// definition | external | import | expression | ';'
 void MainLoop()
 {
     while (true)
@@ -152,6 +377,9 @@ void MainLoop()
         case tok_extern:
             HandleExtern();
             break;
+        case tok_import:
+            HandleImport();
+            break;
         default:
             // fprintf(stderr, "Entering HandleTopLevelExpression()");
             HandleTopLevelExpression();
@@ -159,3 +387,52 @@ void MainLoop()
         }
     }
 }
+
+bool ParseSource(const string &Src, const SourceHandlers &H)
+{
+    PushParserSource(Src);
+    getNextToken();
+    bool Ok = true;
+    while (Ok && CurTok != tok_eof)
+    {
+        switch (CurTok)
+        {
+        case ';':
+            getNextToken();
+            break;
+        case tok_def:
+        {
+            if (H.RecordKeys)
+                StartTokenRecording();
+            auto FnAST = ParseDefinition();
+            string Key = H.RecordKeys ? StopTokenRecording() : "";
+            Ok = FnAST && H.Def(std::move(FnAST), Key);
+            break;
+        }
+        case tok_extern:
+        {
+            auto ProtoAST = ParseExtern();
+            Ok = ProtoAST && ProtoAST->codegen() && H.Extern(std::move(ProtoAST));
+            break;
+        }
+        case tok_import:
+        {
+            string Name = ParseImport();
+            Ok = !Name.empty() && H.Import(Name);
+            break;
+        }
+        default:
+        {
+            string Name = NewTopLevelExprName();
+            if (H.RecordKeys)
+                StartTokenRecording();
+            auto FnAST = ParseTopLevelExpr(Name);
+            string Key = H.RecordKeys ? StopTokenRecording() : "";
+            Ok = FnAST && H.Expr(std::move(FnAST), Name, Key);
+            break;
+        }
+        }
+    }
+    PopParserSource();
+    return Ok;
+}
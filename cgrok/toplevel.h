@@ -5,15 +5,56 @@
 #include "parser.h"
 #include "lexer.h"
 
+#include <functional>
+
 using namespace llvm;
 using namespace llvm::orc;
 
 void InitializeModuleAndManagers();
 void HandleDefinition();
+
+// compile a parsed def and make it the function's definition, replacing any earlier one.
+// Echo prints its IR. returns false (after logging) if it didn't make it into the JIT,
+// which leaves the function the way it was
+bool DefineFunction(unique_ptr<FunctionAST> FnAST, bool Echo = false);
+
 void HandleExtern();
 void HandleTopLevelExpression();
 
-// definition | external | expression | ';'
+// unique function name for the next top-level expression
+string NewTopLevelExprName();
+
+// run a parsed top-level expression called Name (interpreted, cached or JIT compiled)
+// and print the result. Key is its normalized token stream, see StartTokenRecording()
+void EvaluateTopLevelExpr(unique_ptr<FunctionAST> FnAST, const string &Name, const string &Key);
+
+// compiled top-level expressions are kept around (LRU) so repeats don't recompile
+// 0 turns the cache off
+void SetExprCacheSize(unsigned N);
+void ClearExprCache();
+
+// interpret one-off top-level expressions instead of JIT compiling them (on by default)
+void SetInterpreterEnabled(bool Enabled);
+
+// definition | external | import | expression | ';'
 void MainLoop();
 
+// what ParseSource does with each item of a source file. a handler returning false stops it.
+// Key is the item's normalized token stream (see StartTokenRecording()), "" unless RecordKeys
+struct SourceHandlers
+{
+    bool RecordKeys = false;
+    function<bool(unique_ptr<FunctionAST> FnAST, const string &Key)> Def;
+    // already codegen'd, the handler puts it in FunctionProtos
+    function<bool(unique_ptr<PrototypeAST> Proto)> Extern;
+    function<bool(const string &Name)> Import; // the name as written
+    // Name is its function's name (NewTopLevelExprName())
+    function<bool(unique_ptr<FunctionAST> FnAST, const string &Name, const string &Key)> Expr;
+};
+
+// the same loop as MainLoop over an in-memory source (a library, a watched or compiled file).
+// returns false at the first item that doesn't parse or that a handler rejects.
+// the parser is back where it was afterwards. Src has to outlive the ASTs
+bool ParseSource(const string &Src, const SourceHandlers &H);
+
 #endif
\ No newline at end of file
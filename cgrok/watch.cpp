@@ -0,0 +1,247 @@
+#include "watch.h"
+#include "codegen.h"
+#include "parser.h"
+#include "lexer.h"
+#include "toplevel.h"
+#include "import.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// ----------------------------------------------------------------------------------------------
+// HOT RELOAD ===================================================================================
+// ----------------------------------------------------------------------------------------------
+
+// what the JIT currently holds for a def loaded from a watched file
+struct WatchedDef
+{
+    size_t Hash; // of the def's normalized token stream
+    size_t NumArgs;
+    bool Generator;
+    set<string> Callees; // functions its code calls (or has a copy of, for generators)
+};
+
+static map<string, WatchedDef> Defs;
+
+// results of parsing the watched files once
+struct ParsedDef
+{
+    unique_ptr<FunctionAST> AST;
+    size_t Hash;
+};
+
+struct ParsedExpr
+{
+    unique_ptr<FunctionAST> AST;
+    string Name;
+    string Key;
+};
+
+static bool readFile(const string &Path, string &Out)
+{
+    ifstream In(Path, ios::binary);
+    if (!In)
+        return false;
+    stringstream SS;
+    SS << In.rdbuf();
+    Out = SS.str();
+    return true;
+}
+
+// parse all of Src, externs are declared as they're seen
+// Src has to stay alive until the parsed ASTs are done with
+static bool parseSource(const string &Src, vector<ParsedDef> &NewDefs, vector<ParsedExpr> &Exprs)
+{
+    SourceHandlers H;
+    H.RecordKeys = true;
+    H.Def = [&](unique_ptr<FunctionAST> FnAST, const string &Key)
+    {
+        NewDefs.push_back({std::move(FnAST), hash<string>()(Key)});
+        return true;
+    };
+    H.Extern = [](unique_ptr<PrototypeAST> ProtoAST)
+    {
+        FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+        return true;
+    };
+    // imported once, edits to a library aren't picked up
+    H.Import = [](const string &Name) { return ImportLibrary(Name); };
+    H.Expr = [&](unique_ptr<FunctionAST> FnAST, const string &Name, const string &Key)
+    {
+        Exprs.push_back({std::move(FnAST), Name, Key});
+        return true;
+    };
+    return ParseSource(Src, H);
+}
+
+// compile one def and swap it into the JIT
+// if it doesn't make it in, the old prototype is put back (its old body is still what runs)
+static bool compileDef(ParsedDef &D)
+{
+    string Name = D.AST->getProto().getName();
+    WatchedDef Def = {D.Hash, D.AST->getProto().getNumArgs(), D.AST->getProto().isGenerator(), {}};
+    ProtoUndo Undo;
+    Undo.save(Name);
+
+    Function *FnIR = D.AST->codegen();
+    if (!FnIR)
+    {
+        Undo.restore();
+        return false;
+    }
+
+    // inlined, so they don't show up as calls
+    Def.Callees = ModuleGenerators;
+
+    for (auto &BB : *FnIR)
+        for (auto &I : BB)
+            if (auto *CB = dyn_cast<CallBase>(&I))
+                if (auto *Callee = CB->getCalledFunction())
+                    Def.Callees.insert(string(Callee->getName()));
+
+    auto Err = TheJIT->addDefinition(Name, ThreadSafeModule(std::move(TheModule), std::move(TheContext)));
+    InitializeModuleAndManagers();
+    if (Err)
+    {
+        logAllUnhandledErrors(std::move(Err), errs(), "Error: ");
+        Undo.restore();
+        return false;
+    }
+
+    Defs[Name] = std::move(Def);
+    return true;
+}
+
+static void reload(const vector<string> &Paths)
+{
+    auto Start = chrono::steady_clock::now();
+
+    // parse everything first, a half-edited file shouldn't replace anything
+    vector<string> Sources(Paths.size());
+    vector<ParsedDef> NewDefs;
+    vector<ParsedExpr> Exprs;
+    for (size_t i = 0; i < Paths.size(); i++)
+    {
+        bool Ok = readFile(Paths[i], Sources[i]);
+        if (!Ok)
+            fprintf(stderr, "Error: could not read %s\n", Paths[i].c_str());
+        else if (!(Ok = parseSource(Sources[i], NewDefs, Exprs)))
+            fprintf(stderr, "Error: %s has errors, nothing reloaded\n", Paths[i].c_str());
+        if (!Ok)
+            return;
+    }
+
+    // defs whose number of parameters changed - their callers were compiled for the old one
+    // same for any change to a generator, its callers have a copy of the old one
+    set<string> Resigned;
+    for (auto &D : NewDefs)
+    {
+        auto &P = D.AST->getProto();
+        auto Old = Defs.find(P.getName());
+        if (Old == Defs.end())
+            continue;
+        bool Generator = Old->second.Generator || P.isGenerator();
+        if (Old->second.NumArgs != P.getNumArgs() || (Generator && Old->second.Hash != D.Hash))
+            Resigned.insert(Old->first);
+    }
+
+    vector<ParsedDef *> Dirty;
+    for (auto &D : NewDefs)
+    {
+        auto Old = Defs.find(D.AST->getProto().getName());
+        bool Changed = Old == Defs.end() || Old->second.Hash != D.Hash;
+        if (!Changed)
+            for (auto &Callee : Old->second.Callees)
+                Changed = Changed || Resigned.count(Callee);
+        if (Changed)
+            Dirty.push_back(&D);
+    }
+
+    // cached top-level expressions were compiled for the old ones, and can't be recompiled
+    if (!Resigned.empty())
+        ClearExprCache();
+
+    // new signatures go in first, so callers compiled after them see the new prototype
+    stable_partition(Dirty.begin(), Dirty.end(),
+                     [&](ParsedDef *D) { return Resigned.count(D->AST->getProto().getName()) != 0; });
+
+    // a resigned def that fails keeps its old prototype and body, so an unedited caller
+    // that was only dirty because of it is still right as it is
+    set<string> FailedResigned;
+    auto onlyFailedCallees = [&](ParsedDef *D)
+    {
+        auto Old = Defs.find(D->AST->getProto().getName());
+        if (Old == Defs.end() || Old->second.Hash != D->Hash)
+            return false;
+        for (auto &Callee : Old->second.Callees)
+            if (Resigned.count(Callee) && !FailedResigned.count(Callee))
+                return false;
+        return true;
+    };
+
+    unsigned Compiled = 0;
+    for (auto *D : Dirty)
+    {
+        const string &Name = D->AST->getProto().getName();
+        if (onlyFailedCallees(D))
+        {
+            fprintf(stderr, "Keeping %s (what it calls didn't change)\n", Name.c_str());
+            continue;
+        }
+        fprintf(stderr, "Compiling %s\n", Name.c_str());
+        if (compileDef(*D))
+            Compiled++;
+        else if (Resigned.count(Name))
+            FailedResigned.insert(Name);
+    }
+
+    double Ms = chrono::duration<double, milli>(chrono::steady_clock::now() - Start).count();
+    fprintf(stderr, "Reloaded %u of %zu definitions in %.2f ms\n", Compiled, NewDefs.size(), Ms);
+
+    for (auto &E : Exprs)
+        EvaluateTopLevelExpr(std::move(E.AST), E.Name, E.Key);
+}
+
+void WatchFiles(const vector<string> &Paths)
+{
+    vector<filesystem::file_time_type> Stamps(Paths.size());
+
+    // true if any file was written since the last check
+    auto touched = [&]()
+    {
+        bool Touched = false;
+        for (size_t i = 0; i < Paths.size(); i++)
+        {
+            error_code EC;
+            auto Stamp = filesystem::last_write_time(Paths[i], EC);
+            if (!EC && Stamp != Stamps[i])
+            {
+                Stamps[i] = Stamp;
+                Touched = true;
+            }
+        }
+        return Touched;
+    };
+
+    // reload() recompiles the callers of a def whose parameters changed
+    AllowSignatureChanges(true);
+
+    touched();
+    reload(Paths);
+    for (;;)
+    {
+        this_thread::sleep_for(chrono::milliseconds(WATCH_POLL_MS));
+        if (touched())
+            reload(Paths);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+----PURPOSE:
+    Hot reload (--watch). Loads the given .grk files, then polls them for changes.
+    On a change every watched file is re-parsed (cheap, see the token array in parser.cpp),
+    each def is hashed by its token stream, and only defs whose hash changed are
+    compiled again - plus the callers of any def whose number of parameters changed.
+    The JIT swaps new bodies in behind the existing stubs, so nothing else is touched.
+    Externs are re-declared and top-level expressions re-run on every reload. Imported
+    libraries are only imported once, edits to them aren't picked up.
+*/
+
+// how often the files are checked
+#define WATCH_POLL_MS 200
+
+// load Paths, then reload them whenever one changes. never returns
+void WatchFiles(const vector<string> &Paths);
+
+#endif
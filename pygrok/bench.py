@@ -0,0 +1,70 @@
+import sys
+import time
+
+from grok_lexer import Lexer
+from grok_compiler import Compiler
+from grok_parser import Parser
+
+import llvmlite.binding as llvm
+from ctypes import CFUNCTYPE, c_int
+
+# Times each phase of the llvmlite backend on the given .grk files, in the same
+# columns as cgrok/bench/bench.cpp so the two can be compared side by side.
+# usage: python bench.py [-r reps] bench/fib.grk ...
+
+
+def now_ms() -> float:
+    return time.perf_counter() * 1000
+
+
+def run_kernel(code: str, reps: int) -> tuple[float, float, float, float]:
+    start = now_ms()
+    p: Parser = Parser(lexer=Lexer(source=code))
+    program = p.parse_program()
+    parse_ms = now_ms() - start
+    if len(p.errors) > 0:
+        raise RuntimeError(p.errors)
+
+    start = now_ms()
+    c: Compiler = Compiler()
+    c.compile(node=program)
+    module = c.module
+    module.triple = llvm.get_default_triple()
+    codegen_ms = now_ms() - start
+
+    start = now_ms()
+    parsed = llvm.parse_assembly(str(module))
+    parsed.verify()
+    target_machine = llvm.Target.from_default_triple().create_target_machine()
+    engine = llvm.create_mcjit_compiler(parsed, target_machine)
+    engine.finalize_object()
+    cfunc = CFUNCTYPE(c_int)(engine.get_function_address('main'))
+    jit_ms = now_ms() - start
+
+    exec_ms = float('inf')
+    for _ in range(reps):
+        start = now_ms()
+        cfunc()
+        exec_ms = min(exec_ms, now_ms() - start)
+
+    return parse_ms, codegen_ms, jit_ms, exec_ms
+
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    reps = 5
+    if len(args) >= 2 and args[0] == "-r":
+        reps = int(args[1])
+        args = args[2:]
+
+    llvm.initialize()
+    llvm.initialize_native_target()
+    llvm.initialize_native_asmprinter()
+
+    print(f'{"kernel":<12} {"lex+parse ms":>12} {"codegen ms":>12} {"jit ms":>12} {"exec ms":>12}')
+    for path in args:
+        with open(path, "r") as f:
+            code: str = f.read()
+        name = path.split("/")[-1].split(".")[0]
+        times = run_kernel(code, reps)
+        print(f'{name:<12} ' + ' '.join(f'{t:>12.3f}' for t in times))